@@ -22,6 +22,117 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// do_ad2cp_beam_to_enu
+NumericVector do_ad2cp_beam_to_enu(NumericVector v, NumericMatrix tm, NumericVector rotation);
+RcppExport SEXP _oce_do_ad2cp_beam_to_enu(SEXP vSEXP, SEXP tmSEXP, SEXP rotationSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericVector >::type v(vSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type tm(tmSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type rotation(rotationSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ad2cp_beam_to_enu(v, tm, rotation));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_ad2cp_status
+IntegerVector do_ad2cp_status(CharacterVector filename, NumericVector index);
+RcppExport SEXP _oce_do_ad2cp_status(SEXP filenameSEXP, SEXP indexSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type index(indexSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ad2cp_status(filename, index));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_ad2cp_common
+List do_ad2cp_common(CharacterVector filename, NumericVector index);
+RcppExport SEXP _oce_do_ad2cp_common(SEXP filenameSEXP, SEXP indexSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type index(indexSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ad2cp_common(filename, index));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_ad2cp_data
+List do_ad2cp_data(CharacterVector filename, NumericVector index, IntegerVector dataLength, IntegerVector id, IntegerVector threads, IntegerVector DEBUG);
+RcppExport SEXP _oce_do_ad2cp_data(SEXP filenameSEXP, SEXP indexSEXP, SEXP dataLengthSEXP, SEXP idSEXP, SEXP threadsSEXP, SEXP DEBUGSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type dataLength(dataLengthSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type id(idSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type DEBUG(DEBUGSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ad2cp_data(filename, index, dataLength, id, threads, DEBUG));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_ad2cp_echosounder_raw
+List do_ad2cp_echosounder_raw(CharacterVector filename, NumericVector index, IntegerVector dataLength, IntegerVector id, IntegerVector threads, IntegerVector DEBUG);
+RcppExport SEXP _oce_do_ad2cp_echosounder_raw(SEXP filenameSEXP, SEXP indexSEXP, SEXP dataLengthSEXP, SEXP idSEXP, SEXP threadsSEXP, SEXP DEBUGSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type index(indexSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type dataLength(dataLengthSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type id(idSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type DEBUG(DEBUGSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ad2cp_echosounder_raw(filename, index, dataLength, id, threads, DEBUG));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_adv_sontek_serial_files
+List do_adv_sontek_serial_files(StringVector filename);
+RcppExport SEXP _oce_do_adv_sontek_serial_files(SEXP filenameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< StringVector >::type filename(filenameSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_adv_sontek_serial_files(filename));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_adv_vector_decode
+List do_adv_vector_decode(RawVector buf, NumericVector vvdStart, NumericVector vsdStart, NumericVector vsdTime, NumericVector vvdhTime, NumericVector vvdhRecords, NumericVector look, NumericVector velocityScale, NumericVector f);
+RcppExport SEXP _oce_do_adv_vector_decode(SEXP bufSEXP, SEXP vvdStartSEXP, SEXP vsdStartSEXP, SEXP vsdTimeSEXP, SEXP vvdhTimeSEXP, SEXP vvdhRecordsSEXP, SEXP lookSEXP, SEXP velocityScaleSEXP, SEXP fSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type vvdStart(vvdStartSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type vsdStart(vsdStartSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type vsdTime(vsdTimeSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type vvdhTime(vvdhTimeSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type vvdhRecords(vvdhRecordsSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type look(lookSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type velocityScale(velocityScaleSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type f(fSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_adv_vector_decode(buf, vvdStart, vsdStart, vsdTime, vvdhTime, vvdhRecords, look, velocityScale, f));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_adv_vector_imu
+List do_adv_vector_imu(RawVector buf, NumericVector imuStart);
+RcppExport SEXP _oce_do_adv_vector_imu(SEXP bufSEXP, SEXP imuStartSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type imuStart(imuStartSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_adv_vector_imu(buf, imuStart));
+    return rcpp_result_gen;
+END_RCPP
+}
 // do_adv_vector_time
 NumericVector do_adv_vector_time(NumericVector vvdStart, NumericVector vsdStart, NumericVector vsdTime, NumericVector vvdhStart, NumericVector vvdhTime, NumericVector n, NumericVector f);
 RcppExport SEXP _oce_do_adv_vector_time(SEXP vvdStartSEXP, SEXP vsdStartSEXP, SEXP vsdTimeSEXP, SEXP vvdhStartSEXP, SEXP vvdhTimeSEXP, SEXP nSEXP, SEXP fSEXP) {
@@ -152,12 +263,12 @@ BEGIN_RCPP
 END_RCPP
 }
 // do_gappy_index
-IntegerVector do_gappy_index(IntegerVector starts, IntegerVector offset, IntegerVector length);
+SEXP do_gappy_index(NumericVector starts, IntegerVector offset, IntegerVector length);
 RcppExport SEXP _oce_do_gappy_index(SEXP startsSEXP, SEXP offsetSEXP, SEXP lengthSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< IntegerVector >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type starts(startsSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type offset(offsetSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type length(lengthSEXP);
     rcpp_result_gen = Rcpp::wrap(do_gappy_index(starts, offset, length));
@@ -238,6 +349,21 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// do_checksum
+IntegerVector do_checksum(RawVector buf, NumericVector start, int n, int seed, int words);
+RcppExport SEXP _oce_do_checksum(SEXP bufSEXP, SEXP startSEXP, SEXP nSEXP, SEXP seedSEXP, SEXP wordsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type words(wordsSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_checksum(buf, start, n, seed, words));
+    return rcpp_result_gen;
+END_RCPP
+}
 // do_gradient
 List do_gradient(NumericMatrix m, NumericVector x, NumericVector y);
 RcppExport SEXP _oce_do_gradient(SEXP mSEXP, SEXP xSEXP, SEXP ySEXP) {
@@ -295,23 +421,23 @@ BEGIN_RCPP
 END_RCPP
 }
 // do_ldc_ad2cp_in_file
-List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerVector to, IntegerVector by, IntegerVector DEBUG);
-RcppExport SEXP _oce_do_ldc_ad2cp_in_file(SEXP filenameSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP bySEXP, SEXP DEBUGSEXP) {
+List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector id, IntegerVector skipUnwanted, StringVector indexFile, IntegerVector DEBUG);
+RcppExport SEXP _oce_do_ldc_ad2cp_in_file(SEXP filenameSEXP, SEXP idSEXP, SEXP skipUnwantedSEXP, SEXP indexFileSEXP, SEXP DEBUGSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterVector >::type filename(filenameSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type from(fromSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type to(toSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type by(bySEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type id(idSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type skipUnwanted(skipUnwantedSEXP);
+    Rcpp::traits::input_parameter< StringVector >::type indexFile(indexFileSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type DEBUG(DEBUGSEXP);
-    rcpp_result_gen = Rcpp::wrap(do_ldc_ad2cp_in_file(filename, from, to, by, DEBUG));
+    rcpp_result_gen = Rcpp::wrap(do_ldc_ad2cp_in_file(filename, id, skipUnwanted, indexFile, DEBUG));
     return rcpp_result_gen;
 END_RCPP
 }
 // do_ldc_rdi_in_file
-List do_ldc_rdi_in_file(StringVector filename, IntegerVector from, IntegerVector to, IntegerVector by, IntegerVector startIndex, IntegerVector mode, IntegerVector debug);
-RcppExport SEXP _oce_do_ldc_rdi_in_file(SEXP filenameSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP bySEXP, SEXP startIndexSEXP, SEXP modeSEXP, SEXP debugSEXP) {
+List do_ldc_rdi_in_file(StringVector filename, IntegerVector from, IntegerVector to, IntegerVector by, IntegerVector startIndex, IntegerVector mode, StringVector indexFile, IntegerVector threads, NumericVector cursor, IntegerVector debug);
+RcppExport SEXP _oce_do_ldc_rdi_in_file(SEXP filenameSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP bySEXP, SEXP startIndexSEXP, SEXP modeSEXP, SEXP indexFileSEXP, SEXP threadsSEXP, SEXP cursorSEXP, SEXP debugSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -321,8 +447,11 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< IntegerVector >::type by(bySEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type startIndex(startIndexSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type mode(modeSEXP);
+    Rcpp::traits::input_parameter< StringVector >::type indexFile(indexFileSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type cursor(cursorSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type debug(debugSEXP);
-    rcpp_result_gen = Rcpp::wrap(do_ldc_rdi_in_file(filename, from, to, by, startIndex, mode, debug));
+    rcpp_result_gen = Rcpp::wrap(do_ldc_rdi_in_file(filename, from, to, by, startIndex, mode, indexFile, threads, cursor, debug));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -377,6 +506,23 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// do_rdi_decode_ensembles
+List do_rdi_decode_ensembles(RawVector buf, NumericVector ensembleStart, IntegerVector numberOfBeams, IntegerVector numberOfCells, IntegerVector numberOfVCells, IntegerVector found, IntegerVector isSentinel);
+RcppExport SEXP _oce_do_rdi_decode_ensembles(SEXP bufSEXP, SEXP ensembleStartSEXP, SEXP numberOfBeamsSEXP, SEXP numberOfCellsSEXP, SEXP numberOfVCellsSEXP, SEXP foundSEXP, SEXP isSentinelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type ensembleStart(ensembleStartSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type numberOfBeams(numberOfBeamsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type numberOfCells(numberOfCellsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type numberOfVCells(numberOfVCellsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type found(foundSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type isSentinel(isSentinelSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_rdi_decode_ensembles(buf, ensembleStart, numberOfBeams, numberOfCells, numberOfVCells, found, isSentinel));
+    return rcpp_result_gen;
+END_RCPP
+}
 // do_runlm
 List do_runlm(NumericVector x, NumericVector y, NumericVector xout, NumericVector window, NumericVector L);
 RcppExport SEXP _oce_do_runlm(SEXP xSEXP, SEXP ySEXP, SEXP xoutSEXP, SEXP windowSEXP, SEXP LSEXP) {
@@ -409,30 +555,69 @@ BEGIN_RCPP
 END_RCPP
 }
 // do_ldc_sontek_adp
-IntegerVector do_ldc_sontek_adp(RawVector buf, IntegerVector have_ctd, IntegerVector have_gps, IntegerVector have_bottom_track, IntegerVector pcadp, IntegerVector max);
-RcppExport SEXP _oce_do_ldc_sontek_adp(SEXP bufSEXP, SEXP have_ctdSEXP, SEXP have_gpsSEXP, SEXP have_bottom_trackSEXP, SEXP pcadpSEXP, SEXP maxSEXP) {
+List do_ldc_sontek_adp(RawVector buf, IntegerVector pcadp, IntegerVector max);
+RcppExport SEXP _oce_do_ldc_sontek_adp(SEXP bufSEXP, SEXP pcadpSEXP, SEXP maxSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type have_ctd(have_ctdSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type have_gps(have_gpsSEXP);
-    Rcpp::traits::input_parameter< IntegerVector >::type have_bottom_track(have_bottom_trackSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type pcadp(pcadpSEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type max(maxSEXP);
-    rcpp_result_gen = Rcpp::wrap(do_ldc_sontek_adp(buf, have_ctd, have_gps, have_bottom_track, pcadp, max));
+    rcpp_result_gen = Rcpp::wrap(do_ldc_sontek_adp(buf, pcadp, max));
     return rcpp_result_gen;
 END_RCPP
 }
-// do_epic_time_to_ymdhms
-List do_epic_time_to_ymdhms(IntegerVector julianDay, IntegerVector millisecond);
-RcppExport SEXP _oce_do_epic_time_to_ymdhms(SEXP julianDaySEXP, SEXP millisecondSEXP) {
+// do_sontek_adp_decode
+List do_sontek_adp_decode(RawVector buf, NumericVector start, IntegerVector layout, IntegerVector pcadp);
+RcppExport SEXP _oce_do_sontek_adp_decode(SEXP bufSEXP, SEXP startSEXP, SEXP layoutSEXP, SEXP pcadpSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type start(startSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type layout(layoutSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type pcadp(pcadpSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_sontek_adp_decode(buf, start, layout, pcadp));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_epic_time_to_posixct
+NumericVector do_epic_time_to_posixct(IntegerVector julianDay, IntegerVector millisecond);
+RcppExport SEXP _oce_do_epic_time_to_posixct(SEXP julianDaySEXP, SEXP millisecondSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< IntegerVector >::type julianDay(julianDaySEXP);
     Rcpp::traits::input_parameter< IntegerVector >::type millisecond(millisecondSEXP);
-    rcpp_result_gen = Rcpp::wrap(do_epic_time_to_ymdhms(julianDay, millisecond));
+    rcpp_result_gen = Rcpp::wrap(do_epic_time_to_posixct(julianDay, millisecond));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_ymdhms_to_posixct
+NumericVector do_ymdhms_to_posixct(NumericVector year, NumericVector month, NumericVector day, NumericVector hour, NumericVector minute, NumericVector second);
+RcppExport SEXP _oce_do_ymdhms_to_posixct(SEXP yearSEXP, SEXP monthSEXP, SEXP daySEXP, SEXP hourSEXP, SEXP minuteSEXP, SEXP secondSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericVector >::type year(yearSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type month(monthSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type day(daySEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type hour(hourSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type minute(minuteSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type second(secondSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_ymdhms_to_posixct(year, month, day, hour, minute, second));
+    return rcpp_result_gen;
+END_RCPP
+}
+// do_nortek_clock_to_posixct
+NumericVector do_nortek_clock_to_posixct(RawVector buf, NumericVector clock);
+RcppExport SEXP _oce_do_nortek_clock_to_posixct(SEXP bufSEXP, SEXP clockSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< RawVector >::type buf(bufSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type clock(clockSEXP);
+    rcpp_result_gen = Rcpp::wrap(do_nortek_clock_to_posixct(buf, clock));
     return rcpp_result_gen;
 END_RCPP
 }
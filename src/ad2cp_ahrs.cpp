@@ -35,3 +35,81 @@ NumericMatrix do_ad2cp_ahrs(NumericMatrix v, NumericMatrix ahrs)
     return(enu);
 }
 
+
+// Convert the velocities of AD2CP profiles to ENU coordinates, using the
+// rotation matrix that the AHRS records for each profile, in a single
+// pass over the velocity array.
+//
+// 'v' is a [profile, cell, beam] array, in beam coordinates if 'tm'
+// is a beam-to-xyz transformation matrix with a column for each beam,
+// or in xyz coordinates if 'tm' has no rows.  'rotation' is the
+// [profile, 3, 3] array named AHRS$rotationMatrix by read.adp.ad2cp(),
+// which rotates xyz to enu.  The result has the dimensions of 'v', with
+// east, north and up as its first three components; any others (e.g.
+// the second estimate of vertical velocity, for four beams) are left in
+// xyz coordinates. A result is NA if any of the values it depends on is
+// NA; for xyz input, the 4th component is copied, and has no effect on
+// the others.
+//
+// This replaces R code that made an nc-fold copy of each row of the
+// rotation matrix (with rep()), or called do_ad2cp_ahrs() once per cell.
+// The arrays are laid out with the profile varying fastest, so the
+// inner loop runs over profiles, for which the loads are contiguous,
+// and may be vectorized.
+//
+// [[Rcpp::export]]
+NumericVector do_ad2cp_beam_to_enu(NumericVector v, NumericMatrix tm, NumericVector rotation)
+{
+  IntegerVector dim = v.attr("dim");
+  if (dim.size() != 3)
+    Rf_error("v must be a 3-dimensional array");
+  R_xlen_t np = dim[0];
+  int nc = dim[1], nb = dim[2];
+  if (nb < 3 || nb > 4)
+    Rf_error("dim(v)[3] must be 3 or 4, but it is %d", nb);
+  int beam = tm.nrow() > 0;
+  if (beam && (tm.nrow() != nb || tm.ncol() != nb))
+    Rf_error("tm must be %dx%d, to match dim(v)[3], but it is %dx%d", nb, nb, tm.nrow(), tm.ncol());
+  if (rotation.size() != np * 9)
+    Rf_error("rotation must have 9 values for each of the %lld profiles, but it has %lld values",
+        (long long)np, (long long)rotation.size());
+  NumericVector enu(np * nc * nb);
+  enu.attr("dim") = dim;
+  const double *V = v.begin(), *M = rotation.begin();
+  double *E = enu.begin();
+  // The beam-to-xyz matrix, padded to 4x4, and the identity matrix
+  // for xyz input.
+  double t[16];
+  for (int r = 0; r < 4; r++)
+    for (int b = 0; b < 4; b++)
+      t[r + 4 * b] = (beam && r < nb && b < nb) ? tm(r, b) : (r == b ? 1.0 : 0.0);
+  R_xlen_t ncell = (R_xlen_t)np * nc;
+  for (int c = 0; c < nc; c++) {
+    const double *v0 = V + np * c, *v1 = v0 + ncell, *v2 = v1 + ncell;
+    const double *v3 = nb > 3 ? v2 + ncell : v2;
+    double *e0 = E + np * c, *e1 = e0 + ncell, *e2 = e1 + ncell;
+    double *e3 = nb > 3 ? e2 + ncell : e2;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (R_xlen_t i = 0; i < np; i++) {
+      double b0 = v0[i], b1 = v1[i], b2 = v2[i], b3 = nb > 3 ? v3[i] : 0.0;
+      double x = t[0] * b0 + t[4] * b1 + t[8] * b2 + t[12] * b3;
+      double y = t[1] * b0 + t[5] * b1 + t[9] * b2 + t[13] * b3;
+      double z = t[2] * b0 + t[6] * b1 + t[10] * b2 + t[14] * b3;
+      double w = t[3] * b0 + t[7] * b1 + t[11] * b2 + t[15] * b3;
+      const double *m = M + i;
+      double east = m[0] * x + m[3 * np] * y + m[6 * np] * z;
+      double north = m[np] * x + m[4 * np] * y + m[7 * np] * z;
+      double up = m[2 * np] * x + m[5 * np] * y + m[8 * np] * z;
+      int bad = ISNAN(b0) || ISNAN(b1) || ISNAN(b2) || (beam && ISNAN(b3))
+        || ISNAN(east) || ISNAN(north) || ISNAN(up);
+      e0[i] = bad ? NA_REAL : east;
+      e1[i] = bad ? NA_REAL : north;
+      e2[i] = bad ? NA_REAL : up;
+      if (nb > 3)
+        e3[i] = beam ? (bad ? NA_REAL : w) : b3;
+    }
+  }
+  return(enu);
+}
@@ -0,0 +1,910 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+#include <string.h>
+#include <Rcpp.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "civil_time.h"
+#include "compact_array.h"
+#include "mapped_file.h"
+using namespace Rcpp;
+
+// Decode Nortek AD2CP data records, for read.adp.ad2cp().
+//
+// The records are found by do_ldc_ad2cp_in_file(), whose 'index' (the
+// 0-based file offset of each data record) and 'dataLength' are passed
+// here.  Each record is examined where it lies in the memory-mapped
+// file (see mapped_file.h), and its fields are written straight into
+// the arrays that read.adp.ad2cp() returns.  Formerly, the R code read
+// the whole file into a raw vector, built vectors of pointers to each
+// byte of each field with gappyIndex(), and then used readBin() on
+// each field; for large files, those pointer vectors were several
+// times the size of the file.
+//
+// Offsets in the comments are 0-based, counting from the start of the
+// data record, i.e. from the byte after the header.  The R code used
+// 1-based offsets, so e.g. the year, at offset 8 here, was at d$index+9
+// there.
+//
+// References
+//
+// 1. Nortek AS. "Signature Integration 55|250|500|1000kHz." Nortek AS,
+// 2017.
+//
+// 2. Nortek AS. "Signature Integration 55|250|500|1000kHz (Version
+// 2022.2)." Nortek AS, March 31, 2022.
+//
+// Cross-reference work:
+// 1. update ../src/registerDynamicSymbol.c with an item for this
+// 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
+
+// Number of bytes of the common part of burst, average and similar
+// records [2 table 6.2 page 81], which read.adp.ad2cp() decodes for
+// every record it keeps.
+#define COMMON_BYTES 76
+
+// Bits of the 'configuration' word [2 table 6.2 page 81].  The R code
+// holds these in a 16-column matrix, so that e.g. VELOCITY_INCLUDED is
+// column 6 there.
+#define VELOCITY_INCLUDED     (1 << 5)
+#define AMPLITUDE_INCLUDED    (1 << 6)
+#define CORRELATION_INCLUDED  (1 << 7)
+#define ALTIMETER_INCLUDED    (1 << 8)
+#define ALTIMETER_RAW_INCLUDED (1 << 9)
+#define AST_INCLUDED          (1 << 10)
+#define ECHOSOUNDER_INCLUDED  (1 << 11)
+#define AHRS_INCLUDED         (1 << 12)
+#define PERCENT_GOOD_INCLUDED (1 << 13)
+#define STD_DEV_INCLUDED      (1 << 14)
+// For bottom-track records [2 table 6.7 page 93], bits 7 and 8 mean
+// that distance and figure-of-merit are present.
+#define DISTANCE_INCLUDED     (1 << 7)
+#define FOM_INCLUDED          (1 << 8)
+
+static inline unsigned int ad2cp_u16(const unsigned char *p)
+{
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+static inline int ad2cp_i16(const unsigned char *p)
+{
+  return (short)ad2cp_u16(p);
+}
+
+static inline unsigned int ad2cp_u32(const unsigned char *p)
+{
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8)
+    | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline int ad2cp_i32(const unsigned char *p)
+{
+  return (int)ad2cp_u32(p);
+}
+
+static inline double ad2cp_f32(const unsigned char *p)
+{
+  unsigned int u = ad2cp_u32(p);
+  float f;
+  memcpy(&f, &u, 4);
+  return f;
+}
+
+// Where the items of a record lie, as worked out from its ID and the
+// bits of its configuration word. Offsets are -1 for absent items.
+typedef struct {
+  unsigned int config;
+  int nbeam, ncell;      // number of beams and cells in v, a, q, etc.
+  int nsample;           // number of altimeterRaw or echosounderRaw samples
+  long long v, a, q, altimeter, AST, altimeterRaw, echosounder, AHRS;
+  long long percentGood, stdDev;
+  long long ensemble, distance, figureOfMerit; // bottom track only
+  long long samples;     // echosounderRaw only
+} ad2cp_layout;
+
+#define AD2CP_IS_TRACK(id) ((id) == 0x17 || (id) == 0x1b)
+#define AD2CP_IS_ECHOSOUNDER_RAW(id) ((id) == 0x23 || (id) == 0x24)
+
+// Work out the layout of the 'n'-byte record 'p', which has the given
+// ID, returning 0 if the record is long enough to hold all of its
+// items, or 1 otherwise.  The offsets follow the R code that this
+// replaces, which (e.g.) starts the items of profile records at offset
+// 76 rather than at the 'offsetOfData' stated in the record.
+static int ad2cp_find_layout(const unsigned char *p, long long n, int id, ad2cp_layout *L)
+{
+  L->config = 0;
+  L->nbeam = L->ncell = L->nsample = 0;
+  L->v = L->a = L->q = L->altimeter = L->AST = L->altimeterRaw = -1;
+  L->echosounder = L->AHRS = L->percentGood = L->stdDev = -1;
+  L->ensemble = L->distance = L->figureOfMerit = L->samples = -1;
+  if (n < COMMON_BYTES)
+    return 1;
+  unsigned int config = L->config = ad2cp_u16(p + 2);
+  unsigned int bcc = ad2cp_u16(p + 30);
+  long long o;
+  if (AD2CP_IS_ECHOSOUNDER_RAW(id)) {
+    // [2 sec 2.4], and emails from Nortek in August 2022.
+    L->nsample = ad2cp_i32(p + 20);
+    if (L->nsample < 0)
+      return 1;
+    L->samples = p[1];
+    return L->samples + 8LL * L->nsample > n;
+  }
+  if (id == 0x1c) {
+    // The echosounder cells, which may be more than the 1023 that
+    // fit in the bits of an ordinary BCC word, start at offsetOfData
+    // [2 sec 6.4 page 87].
+    L->ncell = bcc;
+    o = p[1];
+    if (config & ECHOSOUNDER_INCLUDED) {
+      L->echosounder = o;
+      o += 2LL * L->ncell;
+    }
+    return o > n;
+  }
+  // BCC bits 0-9 hold the number of cells, and bits 12-15 the number
+  // of beams [1 page 49].
+  L->ncell = bcc & 0x3ff;
+  L->nbeam = bcc >> 12;
+  long long nbc = (long long)L->nbeam * L->ncell;
+  if (AD2CP_IS_TRACK(id)) {
+    // [1 table 6.1.3 page 60] and [2 table 6.7 page 93]
+    L->ensemble = 74;
+    o = 78;
+    if (config & VELOCITY_INCLUDED) {
+      L->v = o;
+      o += 4LL * L->nbeam;
+    }
+    if (config & DISTANCE_INCLUDED) {
+      L->distance = o;
+      o += 4LL * L->nbeam;
+    }
+    if (config & FOM_INCLUDED) {
+      L->figureOfMerit = o;
+      o += 2LL * L->nbeam;
+    }
+    return o > n;
+  }
+  // Burst, average and similar records [1 table 6.1.2 pages 48-54].
+  // Note that altimeterRaw follows AST in the record, although the
+  // configuration bits are in the other order.
+  o = 76;
+  if (config & VELOCITY_INCLUDED) {
+    L->v = o;
+    o += 2 * nbc;
+  }
+  if (config & AMPLITUDE_INCLUDED) {
+    L->a = o;
+    o += nbc;
+  }
+  if (config & CORRELATION_INCLUDED) {
+    L->q = o;
+    o += nbc;
+  }
+  if (config & ALTIMETER_INCLUDED) {
+    L->altimeter = o;
+    o += 8;
+  }
+  if (config & AST_INCLUDED) {
+    L->AST = o;
+    o += 20;                   // includes 8 spare bytes
+  }
+  if (config & ALTIMETER_RAW_INCLUDED) {
+    L->altimeterRaw = o;
+    if (o + 6 > n)
+      return 1;
+    L->nsample = ad2cp_i32(p + o);
+    if (L->nsample < 0)
+      return 1;
+    o += 6 + 2LL * L->nsample;
+  }
+  if (config & ECHOSOUNDER_INCLUDED) {
+    L->echosounder = o;
+    o += 2LL * L->ncell;
+  }
+  if (config & AHRS_INCLUDED) {
+    L->AHRS = o;
+    o += 64;
+  }
+  if (config & PERCENT_GOOD_INCLUDED) {
+    L->percentGood = o;
+    o += 4;
+  }
+  if (config & STD_DEV_INCLUDED) {
+    L->stdDev = o;
+    o += 34;                   // includes 24 dummy bytes
+  }
+  return o > n;
+}
+
+// Storage for the decoded items, set up by do_ad2cp_data() to match
+// the layout of the first record.  Items that the first record lacks
+// have NULL pointers, and are not filled in for any record.
+typedef struct {
+  R_xlen_t np;
+  int nbeam, ncell, nsample;
+  double *v;                   // [np, nbeam], for bottom track
+  short *v16;                  // [np, ncell, nbeam], for profiles (see compact_array.h)
+  double *vScale;              // [np], velocity factor of each profile
+  unsigned char *a, *q;        // [np, ncell, nbeam]
+  double *altimeterDistance;
+  int *altimeterQuality, *altimeterStatus;
+  double *ASTDistance;
+  int *ASTQuality, *ASTOffset;
+  double *ASTPressure;
+  int *altimeterRawSamples;    // [np, nsample]
+  int *echosounder;            // [np, ncell]
+  double *rotationMatrix;      // [np, 3, 3]
+  double *quaternion[4];       // w, x, y, z
+  double *gyro[3];             // x, y, z
+  int *percentGood;            // 4 per record
+  double *stdDev[5];           // pitch, roll, heading, pressure, stdDev
+  int *ensemble;
+  double *distance;            // [np, nbeam]
+  int *figureOfMerit;          // [np, nbeam]
+  Rcomplex *samples;           // [np, nsample]
+  float *sampleReal, *sampleImag; // [np, nsample], in place of 'samples'
+  double *time;
+} ad2cp_arrays;
+
+// Decode the items of record 'p' (with layout 'L') into profile 'ip'
+// of 'out', returning 1 if some items could not be stored because the
+// record's dimensions differ from those of the first record, or 0
+// otherwise.  This makes no R API calls.
+static int ad2cp_decode_record(const unsigned char *p, const ad2cp_layout *L, int id,
+    R_xlen_t ip, ad2cp_arrays *out)
+{
+  R_xlen_t np = out->np;
+  int mismatch = 0;
+  if (AD2CP_IS_ECHOSOUNDER_RAW(id)) {
+    // The time, at offset 2, has 1/100 s in place of the 1e-4 s of
+    // other records.
+    double t = oce_civil_to_seconds(1900 + p[2], 1 + p[3], p[4], p[5], p[6], p[7] + 0.01 * p[8]);
+    out->time[ip] = ISNAN(t) ? NA_REAL : t;
+    if (L->nsample != out->nsample)
+      return 1;
+    // Complex samples, as pairs of int32 values scaled to the range -1
+    // to 1.
+    const unsigned char *s = p + L->samples;
+    if (out->samples) {
+      for (int k = 0; k < L->nsample; k++, s += 8) {
+        Rcomplex z;
+        z.r = ad2cp_i32(s) / 2147483648.0;
+        z.i = ad2cp_i32(s + 4) / 2147483648.0;
+        out->samples[ip + np * k] = z;
+      }
+    } else {
+      for (int k = 0; k < L->nsample; k++, s += 8) {
+        out->sampleReal[ip + np * k] = (float)(ad2cp_i32(s) / 2147483648.0);
+        out->sampleImag[ip + np * k] = (float)(ad2cp_i32(s + 4) / 2147483648.0);
+      }
+    }
+    return 0;
+  }
+  if (id == 0x1c) {
+    if (out->echosounder && L->echosounder >= 0) {
+      if (L->ncell != out->ncell)
+        return 1;
+      for (int c = 0; c < L->ncell; c++)
+        out->echosounder[ip + np * c] = ad2cp_u16(p + L->echosounder + 2 * c);
+    }
+    return 0;
+  }
+  int sameBeams = L->nbeam == out->nbeam;
+  int sameCells = sameBeams && L->ncell == out->ncell;
+  if (AD2CP_IS_TRACK(id)) {
+    double factor = pow(10.0, (signed char)p[60]);
+    out->ensemble[ip] = ad2cp_i32(p + L->ensemble);
+    if (!sameBeams)
+      return out->v || out->distance || out->figureOfMerit;
+    for (int b = 0; b < L->nbeam; b++) {
+      if (out->v && L->v >= 0)
+        out->v[ip + np * b] = factor * ad2cp_i32(p + L->v + 4 * b);
+      if (out->distance && L->distance >= 0)
+        out->distance[ip + np * b] = 1e-3 * ad2cp_i32(p + L->distance + 4 * b);
+      if (out->figureOfMerit && L->figureOfMerit >= 0)
+        out->figureOfMerit[ip + np * b] = ad2cp_u16(p + L->figureOfMerit + 2 * b);
+    }
+    return 0;
+  }
+  // Profiles hold the cells of the first beam, then those of the
+  // second, and so on.  That matches the R storage order of a [ncell,
+  // nbeam] matrix, so item k of the record goes to [ip, k] in an
+  // [np, ncell*nbeam] view of the array.
+  R_xlen_t nbc = (R_xlen_t)L->nbeam * L->ncell;
+  if (out->v16 && L->v >= 0) {
+    if (sameCells) {
+      out->vScale[ip] = pow(10.0, (signed char)p[58]);
+      const unsigned char *s = p + L->v;
+      for (R_xlen_t k = 0; k < nbc; k++, s += 2)
+        out->v16[ip + np * k] = (short)ad2cp_i16(s);
+    } else {
+      mismatch = 1;
+    }
+  }
+  if (out->a && L->a >= 0) {
+    if (sameCells) {
+      for (R_xlen_t k = 0; k < nbc; k++)
+        out->a[ip + np * k] = p[L->a + k];
+    } else {
+      mismatch = 1;
+    }
+  }
+  if (out->q && L->q >= 0) {
+    if (sameCells) {
+      for (R_xlen_t k = 0; k < nbc; k++)
+        out->q[ip + np * k] = p[L->q + k];
+    } else {
+      mismatch = 1;
+    }
+  }
+  if (out->altimeterDistance && L->altimeter >= 0) {
+    // [1 page 51] has the distance as a float, although [2 page 89]
+    // says int32; the former gives sensible values.
+    const unsigned char *s = p + L->altimeter;
+    out->altimeterDistance[ip] = ad2cp_f32(s);
+    out->altimeterQuality[ip] = ad2cp_u16(s + 4);
+    out->altimeterStatus[ip] = ad2cp_u16(s + 6);
+  }
+  if (out->ASTDistance && L->AST >= 0) {
+    const unsigned char *s = p + L->AST;
+    out->ASTDistance[ip] = ad2cp_f32(s);
+    out->ASTQuality[ip] = ad2cp_u16(s + 4);
+    out->ASTOffset[ip] = ad2cp_i16(s + 6);
+    out->ASTPressure[ip] = ad2cp_f32(s + 8);
+  }
+  if (out->altimeterRawSamples && L->altimeterRaw >= 0) {
+    if (L->nsample == out->nsample) {
+      const unsigned char *s = p + L->altimeterRaw + 6;
+      for (int k = 0; k < L->nsample; k++)
+        out->altimeterRawSamples[ip + np * k] = ad2cp_i16(s + 2 * k);
+    } else {
+      mismatch = 1;
+    }
+  }
+  if (out->echosounder && L->echosounder >= 0) {
+    if (L->ncell == out->ncell) {
+      for (int c = 0; c < L->ncell; c++)
+        out->echosounder[ip + np * c] = ad2cp_u16(p + L->echosounder + 2 * c);
+    } else {
+      mismatch = 1;
+    }
+  }
+  if (out->rotationMatrix && L->AHRS >= 0) {
+    // The matrix is stored by row (M11, M12, M13, M21, ...).
+    const unsigned char *s = p + L->AHRS;
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 3; c++)
+        out->rotationMatrix[ip + np * (r + 3 * c)] = ad2cp_f32(s + 4 * (3 * r + c));
+    for (int k = 0; k < 4; k++)
+      out->quaternion[k][ip] = ad2cp_f32(s + 36 + 4 * k);
+    for (int k = 0; k < 3; k++)
+      out->gyro[k][ip] = ad2cp_f32(s + 52 + 4 * k);
+  }
+  if (out->percentGood && L->percentGood >= 0) {
+    for (int k = 0; k < 4; k++)
+      out->percentGood[4 * ip + k] = p[L->percentGood + k];
+  }
+  if (out->stdDev[0] && L->stdDev >= 0) {
+    static const double scale[5] = {0.01, 0.01, 0.01, 0.001, 0.01};
+    for (int k = 0; k < 5; k++)
+      out->stdDev[k][ip] = scale[k] * ad2cp_i16(p + L->stdDev + 2 * k);
+  }
+  return mismatch;
+}
+
+static void ad2cp_open(MappedFile& mf, CharacterVector filename)
+{
+  std::string fn = Rcpp::as<std::string>(filename(0));
+  if (mf.open(fn.c_str()))
+    ::Rf_error("cannot open file '%s'\n", fn.c_str());
+}
+
+// Check the arguments that describe the records to be decoded by
+// do_ad2cp_data() or do_ad2cp_echosounder_raw(), returning their ID.
+static int ad2cp_check_records(NumericVector index, IntegerVector dataLength, IntegerVector id)
+{
+  R_xlen_t np = index.size();
+  if (np < 1)
+    ::Rf_error("no records to decode\n");
+  if (dataLength.size() != np || id.size() != np)
+    ::Rf_error("lengths of index (%lld), dataLength (%lld) and id (%lld) must agree\n",
+        (long long)np, (long long)dataLength.size(), (long long)id.size());
+  int ID = id[0];
+  for (R_xlen_t i = 1; i < np; i++) {
+    if (id[i] != ID)
+      ::Rf_error("records must all have the same ID, but record 1 has 0x%02x and record %lld has 0x%02x\n",
+          ID, (long long)i + 1, id[i]);
+  }
+  return ID;
+}
+
+// Decode records into 'out', which has been set up for them, counting
+// records that are too short to decode in 'nshort', and those with
+// dimensions that differ from those of 'out' in 'nmismatch'.  See
+// do_ad2cp_data() for the use of threads.
+static void ad2cp_decode_records(MappedFile& mf, NumericVector index, IntegerVector dataLength,
+    int ID, int nthreads, int debug, ad2cp_arrays *out, R_xlen_t *nshort_out, R_xlen_t *nmismatch_out)
+{
+  R_xlen_t np = index.size();
+  R_xlen_t nshort = 0, nmismatch = 0;
+#ifdef _OPENMP
+  if (nthreads < 1)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  if (!mf.mapped() || np < 2 * nthreads)
+    nthreads = 1;
+  if (debug)
+    Rprintf("  decoding with %d thread%s\n", nthreads, nthreads == 1 ? "" : "s");
+  const double *offset = index.begin();
+  const int *length = dataLength.begin();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:nshort,nmismatch)
+#endif
+  for (R_xlen_t i = 0; i < np; i++) {
+    ad2cp_layout L;
+    const unsigned char *pi = mf.span((long long)offset[i], length[i]);
+    if (!pi || ad2cp_find_layout(pi, length[i], ID, &L)) {
+      nshort++;
+      continue;
+    }
+    nmismatch += ad2cp_decode_record(pi, &L, ID, i, out);
+  }
+  *nshort_out = nshort;
+  *nmismatch_out = nmismatch;
+}
+
+// Read the 32-bit 'status' word [2 table 6.2 page 82] of each record.
+// read.adp.ad2cp() needs this for all the records in the file, to
+// select the records of a given plan, so it is kept apart from
+// do_ad2cp_common(). The value is returned as an integer, i.e. with
+// the top bit as a sign bit, so that intToBits() can unpack it. Records
+// that end too close to the end of the file yield NA.
+//
+// [[Rcpp::export]]
+IntegerVector do_ad2cp_status(CharacterVector filename, NumericVector index)
+{
+  MappedFile mf;
+  ad2cp_open(mf, filename);
+  R_xlen_t n = index.size();
+  IntegerVector status(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    const unsigned char *p = mf.span((long long)index[i], COMMON_BYTES);
+    status[i] = p ? ad2cp_i32(p + 68) : NA_INTEGER;
+  }
+  mf.close();
+  return(status);
+}
+
+// Decode the fields that are common to the records [2 table 6.2 page
+// 81], for the records starting at the given (0-based) file offsets.
+// Scale factors are applied, except to 'blankingDistance', which is
+// in cm or mm depending on a bit in 'status', and the 'configuration'
+// and 'BCC' words are returned whole, for the caller to unpack.  Times
+// are in seconds since 1970-01-01 UTC.  Records that end too close to
+// the end of the file yield NA values.
+//
+// [[Rcpp::export]]
+List do_ad2cp_common(CharacterVector filename, NumericVector index)
+{
+  MappedFile mf;
+  ad2cp_open(mf, filename);
+  R_xlen_t n = index.size();
+  IntegerVector version(n), offsetOfData(n), configuration(n), serialNumber(n);
+  NumericVector time(n), soundSpeed(n), temperature(n), pressure(n);
+  NumericVector heading(n), pitch(n), roll(n), cellSize(n);
+  IntegerVector BCC(n), blankingDistance(n), nominalCorrelation(n);
+  NumericMatrix magnetometer(n, 3), accelerometer(n, 3);
+  IntegerVector datasetDescription(n), transmitEnergy(n), powerLevel(n);
+  NumericVector velocityFactor(n), temperatureMagnetometer(n), temperatureRTC(n);
+  IntegerVector status(n), ensemble(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    const unsigned char *p = mf.span((long long)index[i], COMMON_BYTES);
+    if (!p) {
+      version[i] = offsetOfData[i] = configuration[i] = serialNumber[i] = NA_INTEGER;
+      time[i] = soundSpeed[i] = temperature[i] = pressure[i] = NA_REAL;
+      heading[i] = pitch[i] = roll[i] = cellSize[i] = NA_REAL;
+      BCC[i] = blankingDistance[i] = nominalCorrelation[i] = NA_INTEGER;
+      for (int k = 0; k < 3; k++)
+        magnetometer(i, k) = accelerometer(i, k) = NA_REAL;
+      datasetDescription[i] = transmitEnergy[i] = powerLevel[i] = NA_INTEGER;
+      velocityFactor[i] = temperatureMagnetometer[i] = temperatureRTC[i] = NA_REAL;
+      status[i] = ensemble[i] = NA_INTEGER;
+      continue;
+    }
+    version[i] = p[0];
+    offsetOfData[i] = p[1];
+    configuration[i] = ad2cp_u16(p + 2);
+    serialNumber[i] = ad2cp_i32(p + 4);
+    // Note that the 100 usec part, multiplied by 1e-4, sometimes
+    // exceeds 1s.  The R code did not worry about this, since it gave
+    // the same results as Nortek's matlab code for a test file.
+    double t = oce_civil_to_seconds(1900 + p[8], 1 + p[9], p[10], p[11], p[12],
+        p[13] + 1e-4 * ad2cp_u16(p + 14));
+    time[i] = ISNAN(t) ? NA_REAL : t;
+    soundSpeed[i] = 0.1 * ad2cp_u16(p + 16);
+    temperature[i] = 0.01 * ad2cp_u16(p + 18);
+    // The docs say pressure is uint32, but the R code (which could not
+    // read such values) took it as int32.
+    pressure[i] = 0.001 * ad2cp_i32(p + 20);
+    heading[i] = 0.01 * ad2cp_u16(p + 24);
+    pitch[i] = 0.01 * ad2cp_i16(p + 26);
+    roll[i] = 0.01 * ad2cp_i16(p + 28);
+    BCC[i] = ad2cp_u16(p + 30);
+    cellSize[i] = 0.001 * ad2cp_u16(p + 32);
+    blankingDistance[i] = ad2cp_u16(p + 34);
+    nominalCorrelation[i] = p[36];
+    for (int k = 0; k < 3; k++) {
+      magnetometer(i, k) = ad2cp_i16(p + 40 + 2 * k);
+      accelerometer(i, k) = 1.0 / 16384.0 * ad2cp_i16(p + 46 + 2 * k);
+    }
+    datasetDescription[i] = ad2cp_u16(p + 54);
+    transmitEnergy[i] = ad2cp_u16(p + 56);
+    // This is true only for current-profiler data [2 page 82].
+    velocityFactor[i] = pow(10.0, (signed char)p[58]);
+    powerLevel[i] = (signed char)p[59];
+    temperatureMagnetometer[i] = 0.001 * ad2cp_i16(p + 60);
+    // See https://github.com/dankelley/oce/issues/1957 for the unit.
+    temperatureRTC[i] = 0.01 * ad2cp_i16(p + 62);
+    status[i] = ad2cp_i32(p + 68);
+    ensemble[i] = ad2cp_i32(p + 72);
+  }
+  mf.close();
+  // (This is too many items for List::create().)
+  const char *name[] = {"version", "offsetOfData", "configuration", "serialNumber",
+    "time", "soundSpeed", "temperature", "pressure", "heading", "pitch", "roll",
+    "BCC", "cellSize", "blankingDistance", "nominalCorrelation",
+    "magnetometer", "accelerometer", "datasetDescription", "transmitEnergy",
+    "velocityFactor", "powerLevel", "temperatureMagnetometer", "temperatureRTC",
+    "status", "ensemble"};
+  SEXP item[] = {version, offsetOfData, configuration, serialNumber,
+    time, soundSpeed, temperature, pressure, heading, pitch, roll,
+    BCC, cellSize, blankingDistance, nominalCorrelation,
+    magnetometer, accelerometer, datasetDescription, transmitEnergy,
+    velocityFactor, powerLevel, temperatureMagnetometer, temperatureRTC,
+    status, ensemble};
+  int nitem = sizeof(item) / sizeof(item[0]);
+  List rval(nitem);
+  CharacterVector names(nitem);
+  for (int k = 0; k < nitem; k++) {
+    rval[k] = item[k];
+    names[k] = name[k];
+  }
+  rval.attr("names") = names;
+  return(rval);
+}
+
+// Decode the data items of records that all have the same ID, using
+// the bits in the configuration word of each record to find its items
+// [1 sec 6.1; 2 sec 6].  The dimensions of the returned arrays, and
+// the set of items, are taken from the first record.  Items that a
+// later record lacks are NA (or 0x00, for the raw arrays 'a' and 'q'),
+// as are those that cannot be stored because the record has a
+// different number of beams, cells or samples than the first record;
+// a warning reports how many records had such mismatches.
+//
+// The items are in the order, and have the names and dimensions,
+// that read.adp.ad2cp() uses, except that the bottom-track arrays
+// 'v', 'distance' and 'figureOfMerit' and the 'altimeterRaw$samples'
+// matrix now have one row per record, as intended.  Formerly, they
+// were filled column by column, which scrambled the records and beams
+// (or samples).
+//
+// If 'threads' exceeds 1 (or is 0, meaning as many threads as the
+// system allows), the records are divided into contiguous blocks that
+// are decoded by separate threads. Each record is written to its own
+// row of the arrays, which are allocated beforehand, so the threads do
+// not interfere, and the results do not depend on the number of
+// threads. The threads use only the C-level kernels above, which make
+// no calls to R. As in do_ldc_rdi_in_file(), they need the file to be
+// memory-mapped, because the windowed reading of MappedFile is not
+// thread-safe.
+//
+// [[Rcpp::export]]
+List do_ad2cp_data(CharacterVector filename, NumericVector index, IntegerVector dataLength,
+    IntegerVector id, IntegerVector threads, IntegerVector DEBUG)
+{
+  int debug = DEBUG[0] < 0 ? 0 : DEBUG[0];
+  R_xlen_t np = index.size();
+  int ID = ad2cp_check_records(index, dataLength, id);
+  if (!((ID >= 0x15 && ID <= 0x1f && ID != 0x19) || AD2CP_IS_ECHOSOUNDER_RAW(ID)))
+    ::Rf_error("cannot decode records with ID 0x%02x\n", ID);
+  MappedFile mf;
+  ad2cp_open(mf, filename);
+  // The first record determines what is stored.
+  ad2cp_layout first;
+  const unsigned char *p = mf.span((long long)index[0], dataLength[0]);
+  if (!p || ad2cp_find_layout(p, dataLength[0], ID, &first)) {
+    mf.close();
+    ::Rf_error("the first record, at byte %.0f, is too short to decode\n", index[0]);
+  }
+  if (debug) {
+    Rprintf("do_ad2cp_data(filename, index, dataLength, id, DEBUG=%d) {\n", debug);
+    Rprintf("  ID=0x%02x np=%lld configuration=0x%04x nbeam=%d ncell=%d nsample=%d\n",
+        ID, (long long)np, first.config, first.nbeam, first.ncell, first.nsample);
+  }
+  ad2cp_arrays out;
+  memset(&out, 0, sizeof(out));
+  out.np = np;
+  out.nbeam = first.nbeam;
+  out.ncell = first.ncell;
+  out.nsample = first.nsample;
+  R_xlen_t nbc = (R_xlen_t)first.nbeam * first.ncell;
+  int nb = first.nbeam, nc = first.ncell, ns = first.nsample;
+  // Storage, filled with NA (or 0x00) so that missing items show.
+  NumericVector v, distance, altimeterDistance, ASTDistance, ASTPressure, rotationMatrix;
+  NumericVector quaternion[4], gyro[3], stdDev[5];
+  RawVector a, q;
+  IntegerVector altimeterQuality, altimeterStatus, ASTQuality, ASTOffset;
+  IntegerVector altimeterRawSamples, echosounder, percentGood, ensemble, figureOfMerit;
+  ComplexVector samples;
+  NumericVector time;
+  // Profile velocities are kept as 16-bit values, with a scale factor
+  // for each record, and converted to m/s as R needs them.
+  RObject vCompact;
+  if (AD2CP_IS_ECHOSOUNDER_RAW(ID)) {
+    Rcomplex na;
+    na.r = na.i = NA_REAL;
+    samples = ComplexVector(np * ns, na);
+    samples.attr("dim") = IntegerVector::create((int)np, ns);
+    out.samples = samples.begin();
+    time = NumericVector(np, NA_REAL);
+    out.time = time.begin();
+  } else if (AD2CP_IS_TRACK(ID)) {
+    ensemble = IntegerVector(np, NA_INTEGER);
+    out.ensemble = ensemble.begin();
+    if (first.v >= 0) {
+      v = NumericVector(np * nb, NA_REAL);
+      v.attr("dim") = IntegerVector::create((int)np, nb);
+      out.v = v.begin();
+    }
+    if (first.distance >= 0) {
+      distance = NumericVector(np * nb, NA_REAL);
+      distance.attr("dim") = IntegerVector::create((int)np, nb);
+      out.distance = distance.begin();
+    }
+    if (first.figureOfMerit >= 0) {
+      figureOfMerit = IntegerVector(np * nb, NA_INTEGER);
+      figureOfMerit.attr("dim") = IntegerVector::create((int)np, nb);
+      out.figureOfMerit = figureOfMerit.begin();
+    }
+  } else {
+    if (first.v >= 0 && nbc > 0) {
+      vCompact = oce_scaled_int16(np * nbc, np, OCE_NO_SENTINEL, &out.v16, &out.vScale);
+      vCompact.attr("dim") = IntegerVector::create((int)np, nc, nb);
+    }
+    if (first.a >= 0 && nbc > 0) {
+      a = RawVector(np * nbc);
+      a.attr("dim") = IntegerVector::create((int)np, nc, nb);
+      out.a = a.begin();
+    }
+    if (first.q >= 0 && nbc > 0) {
+      q = RawVector(np * nbc);
+      q.attr("dim") = IntegerVector::create((int)np, nc, nb);
+      out.q = q.begin();
+    }
+    if (first.altimeter >= 0) {
+      altimeterDistance = NumericVector(np, NA_REAL);
+      altimeterQuality = IntegerVector(np, NA_INTEGER);
+      altimeterStatus = IntegerVector(np, NA_INTEGER);
+      out.altimeterDistance = altimeterDistance.begin();
+      out.altimeterQuality = altimeterQuality.begin();
+      out.altimeterStatus = altimeterStatus.begin();
+    }
+    if (first.AST >= 0) {
+      ASTDistance = NumericVector(np, NA_REAL);
+      ASTQuality = IntegerVector(np, NA_INTEGER);
+      ASTOffset = IntegerVector(np, NA_INTEGER);
+      ASTPressure = NumericVector(np, NA_REAL);
+      out.ASTDistance = ASTDistance.begin();
+      out.ASTQuality = ASTQuality.begin();
+      out.ASTOffset = ASTOffset.begin();
+      out.ASTPressure = ASTPressure.begin();
+    }
+    if (first.altimeterRaw >= 0) {
+      altimeterRawSamples = IntegerVector(np * ns, NA_INTEGER);
+      altimeterRawSamples.attr("dim") = IntegerVector::create((int)np, ns);
+      out.altimeterRawSamples = altimeterRawSamples.begin();
+    }
+    if (first.AHRS >= 0) {
+      rotationMatrix = NumericVector(np * 9, NA_REAL);
+      rotationMatrix.attr("dim") = IntegerVector::create((int)np, 3, 3);
+      out.rotationMatrix = rotationMatrix.begin();
+      for (int k = 0; k < 4; k++) {
+        quaternion[k] = NumericVector(np, NA_REAL);
+        out.quaternion[k] = quaternion[k].begin();
+      }
+      for (int k = 0; k < 3; k++) {
+        gyro[k] = NumericVector(np, NA_REAL);
+        out.gyro[k] = gyro[k].begin();
+      }
+    }
+    if (first.percentGood >= 0) {
+      percentGood = IntegerVector(4 * np, NA_INTEGER);
+      out.percentGood = percentGood.begin();
+    }
+    if (first.stdDev >= 0) {
+      for (int k = 0; k < 5; k++) {
+        stdDev[k] = NumericVector(np, NA_REAL);
+        out.stdDev[k] = stdDev[k].begin();
+      }
+    }
+  }
+  if (first.echosounder >= 0) {
+    echosounder = IntegerVector(np * nc, NA_INTEGER);
+    echosounder.attr("dim") = IntegerVector::create((int)np, nc);
+    out.echosounder = echosounder.begin();
+  }
+  // Records that are too short for their items (which should not
+  // happen, since the locator has checked their lengths against their
+  // headers), and records with different dimensions than the first.
+  R_xlen_t nshort, nmismatch;
+  ad2cp_decode_records(mf, index, dataLength, ID, threads[0], debug, &out, &nshort, &nmismatch);
+  // Some scalars are taken from the first record.
+  double ambiguityVelocity = NA_REAL, trackVelocityFactor = NA_REAL;
+  double frequency = NA_REAL, sampleDistance = NA_REAL, samplingRate = NA_REAL;
+  int startSampleIndex = NA_INTEGER;
+  p = mf.span((long long)index[0], dataLength[0]);
+  if (AD2CP_IS_TRACK(ID)) {
+    // The velocity factor is at offset 60, not 58 as for profiles, and
+    // the ambiguity velocity takes 4 bytes, not 2 [2 page 94]. See
+    // https://github.com/dankelley/oce/issues/1980#issuecomment-1188992788
+    trackVelocityFactor = pow(10.0, (signed char)p[60]);
+    ambiguityVelocity = trackVelocityFactor * ad2cp_i32(p + 52);
+  } else if (ID == 0x1c) {
+    // [2 table 6.4 page 87] has no factor for this, but 0.1 matches the
+    // header of a sample file.
+    frequency = 0.1 * ad2cp_u16(p + 52);
+  } else if (AD2CP_IS_ECHOSOUNDER_RAW(ID)) {
+    startSampleIndex = ad2cp_i32(p + 24);
+    samplingRate = ad2cp_f32(p + 28);
+  } else if (first.altimeterRaw >= 0) {
+    sampleDistance = 1e-4 * ad2cp_u16(p + first.altimeterRaw + 4);
+  }
+  mf.close();
+  if (debug)
+    Rprintf("  nshort=%lld nmismatch=%lld\n} # do_ad2cp_data()\n", (long long)nshort, (long long)nmismatch);
+  if (nshort)
+    ::Rf_warning("%lld of the %lld records with ID 0x%02x were too short to decode, and yield NA values",
+        (long long)nshort, (long long)np, ID);
+  if (nmismatch)
+    ::Rf_warning("%lld of the %lld records with ID 0x%02x have a different number of beams, cells or samples than the first, and yield NA values",
+        (long long)nmismatch, (long long)np, ID);
+  if (AD2CP_IS_ECHOSOUNDER_RAW(ID)) {
+    return(List::create(
+          Named("time") = time,
+          Named("numberOfSamples") = ns,
+          Named("samplingRate") = samplingRate,
+          Named("startSampleIndex") = startSampleIndex,
+          Named("samples") = samples));
+  }
+  if (AD2CP_IS_TRACK(ID)) {
+    return(List::create(
+          Named("velocityFactor") = trackVelocityFactor,
+          Named("ambiguityVelocity") = ambiguityVelocity,
+          Named("ensemble") = ensemble,
+          Named("v") = first.v >= 0 ? (SEXP)v : R_NilValue,
+          Named("distance") = first.distance >= 0 ? (SEXP)distance : R_NilValue,
+          Named("figureOfMerit") = first.figureOfMerit >= 0 ? (SEXP)figureOfMerit : R_NilValue));
+  }
+  if (ID == 0x1c) {
+    return(List::create(
+          Named("frequency") = frequency,
+          Named("echosounder") = first.echosounder >= 0 ? (SEXP)echosounder : R_NilValue));
+  }
+  // Profile records.  The altimeterRaw list gets 'blankingDistance',
+  // 'time' and 'distance' from the caller.
+  List altimeter, AST, altimeterRaw, AHRS;
+  if (first.altimeter >= 0)
+    altimeter = List::create(Named("distance") = altimeterDistance,
+        Named("quality") = altimeterQuality,
+        Named("status") = altimeterStatus);
+  if (first.AST >= 0)
+    AST = List::create(Named("distance") = ASTDistance,
+        Named("quality") = ASTQuality,
+        Named("offset") = ASTOffset,
+        Named("pressure") = ASTPressure);
+  if (first.altimeterRaw >= 0)
+    altimeterRaw = List::create(Named("numberOfSamples") = ns,
+        Named("sampleDistance") = sampleDistance,
+        Named("samples") = altimeterRawSamples);
+  if (first.AHRS >= 0)
+    AHRS = List::create(Named("rotationMatrix") = rotationMatrix,
+        Named("quaternions") = List::create(Named("w") = quaternion[0],
+          Named("x") = quaternion[1], Named("y") = quaternion[2], Named("z") = quaternion[3]),
+        Named("gyro") = List::create(Named("x") = gyro[0],
+          Named("y") = gyro[1], Named("z") = gyro[2]));
+  const char *name[] = {"v", "a", "q", "altimeter", "AST", "altimeterRaw", "echosounder", "AHRS",
+    "percentgood", "stdDevPitch", "stdDevRoll", "stdDevHeading", "stdDevPressure", "stdDev"};
+  SEXP item[] = {
+    out.v16 ? (SEXP)vCompact : R_NilValue,
+    out.a ? (SEXP)a : R_NilValue,
+    out.q ? (SEXP)q : R_NilValue,
+    first.altimeter >= 0 ? (SEXP)altimeter : R_NilValue,
+    first.AST >= 0 ? (SEXP)AST : R_NilValue,
+    first.altimeterRaw >= 0 ? (SEXP)altimeterRaw : R_NilValue,
+    first.echosounder >= 0 ? (SEXP)echosounder : R_NilValue,
+    first.AHRS >= 0 ? (SEXP)AHRS : R_NilValue,
+    first.percentGood >= 0 ? (SEXP)percentGood : R_NilValue,
+    first.stdDev >= 0 ? (SEXP)stdDev[0] : R_NilValue,
+    first.stdDev >= 0 ? (SEXP)stdDev[1] : R_NilValue,
+    first.stdDev >= 0 ? (SEXP)stdDev[2] : R_NilValue,
+    first.stdDev >= 0 ? (SEXP)stdDev[3] : R_NilValue,
+    first.stdDev >= 0 ? (SEXP)stdDev[4] : R_NilValue};
+  int nitem = sizeof(item) / sizeof(item[0]);
+  List rval(nitem);
+  CharacterVector names(nitem);
+  for (int k = 0; k < nitem; k++) {
+    rval[k] = item[k];
+    names[k] = name[k];
+  }
+  rval.attr("names") = names;
+  return(rval);
+}
+
+// Decode echosounderRaw (0x23) or echosounderRawTx (0x24) records, as
+// do_ad2cp_data() does, except that the complex samples are returned
+// as two single-precision matrices (see compact_array.h), 'real' and
+// 'imaginary', with one row per record.  These records dominate the
+// size of Signature100 files, and their 32-bit samples are scaled to
+// the range -1 to 1, so doubles (and R's complex type, which is a pair
+// of doubles) quadruple their memory without adding useful precision.
+// This is used by ad2cpEchosounderRaw(), which calls it for successive
+// chunks of records, so that a whole file need not be held in memory.
+//
+// [[Rcpp::export]]
+List do_ad2cp_echosounder_raw(CharacterVector filename, NumericVector index, IntegerVector dataLength,
+    IntegerVector id, IntegerVector threads, IntegerVector DEBUG)
+{
+  int debug = DEBUG[0] < 0 ? 0 : DEBUG[0];
+  R_xlen_t np = index.size();
+  int ID = ad2cp_check_records(index, dataLength, id);
+  if (!AD2CP_IS_ECHOSOUNDER_RAW(ID))
+    ::Rf_error("records must have ID 0x23 or 0x24, not 0x%02x\n", ID);
+  MappedFile mf;
+  ad2cp_open(mf, filename);
+  ad2cp_layout first;
+  const unsigned char *p = mf.span((long long)index[0], dataLength[0]);
+  if (!p || ad2cp_find_layout(p, dataLength[0], ID, &first)) {
+    mf.close();
+    ::Rf_error("the first record, at byte %.0f, is too short to decode\n", index[0]);
+  }
+  int ns = first.nsample;
+  int startSampleIndex = ad2cp_i32(p + 24);
+  double samplingRate = ad2cp_f32(p + 28);
+  if (debug)
+    Rprintf("do_ad2cp_echosounder_raw(filename, index, dataLength, id, DEBUG=%d) {\n  ID=0x%02x np=%lld nsample=%d\n",
+        debug, ID, (long long)np, ns);
+  ad2cp_arrays out;
+  memset(&out, 0, sizeof(out));
+  out.np = np;
+  out.nsample = ns;
+  NumericVector time(np, NA_REAL);
+  out.time = time.begin();
+  RObject real, imaginary;
+  real = oce_float32(np * ns, &out.sampleReal);
+  real.attr("dim") = IntegerVector::create((int)np, ns);
+  imaginary = oce_float32(np * ns, &out.sampleImag);
+  imaginary.attr("dim") = IntegerVector::create((int)np, ns);
+  R_xlen_t nshort, nmismatch;
+  ad2cp_decode_records(mf, index, dataLength, ID, threads[0], debug, &out, &nshort, &nmismatch);
+  mf.close();
+  if (debug)
+    Rprintf("  nshort=%lld nmismatch=%lld\n} # do_ad2cp_echosounder_raw()\n", (long long)nshort, (long long)nmismatch);
+  if (nshort)
+    ::Rf_warning("%lld of the %lld records with ID 0x%02x were too short to decode, and yield NA values",
+        (long long)nshort, (long long)np, ID);
+  if (nmismatch)
+    ::Rf_warning("%lld of the %lld records with ID 0x%02x have a different number of samples than the first, and yield NA values",
+        (long long)nmismatch, (long long)np, ID);
+  return(List::create(
+        Named("time") = time,
+        Named("numberOfSamples") = ns,
+        Named("samplingRate") = samplingRate,
+        Named("startSampleIndex") = startSampleIndex,
+        Named("real") = real,
+        Named("imaginary") = imaginary));
+}
@@ -0,0 +1,191 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// See ad2cp_index.h for an explanation of what this does, and why.
+//
+// File layout. All numbers are little-endian, regardless of the
+// platform, so that an index can be shared between machines.
+//
+//   bytes  contents
+//   0-7    "OCEAD2X1"
+//   8-15   size of the data file, in bytes
+//   16-23  modification time of the data file (seconds since 1970)
+//   24-31  FNV-1a hash of the first HASHED bytes of the data file
+//   32-39  early_EOF
+//   40-47  number of checksum failures
+//   48-55  number of entries
+//   56-    checksum failures, each an 8-byte file offset, followed by
+//          entries, each of RECORD bytes, holding start (8 bytes),
+//          index (8), header_length (1), id (1), data_length (4) and
+//          time (8, as an IEEE double)
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "ad2cp_index.h"
+
+#define MAGIC "OCEAD2X1"
+#define HEADER 56
+#define RECORD 30
+#define HASHED 65536
+
+static int data_file_signature(const char *data_name, long long *size, long long *mtime,
+    unsigned long long *hash)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(data_name, &st))
+    return 1;
+#else
+  struct stat st;
+  if (stat(data_name, &st))
+    return 1;
+#endif
+  *size = (long long)st.st_size;
+  *mtime = (long long)st.st_mtime;
+  // The modification time has a resolution of 1 s on some systems, so
+  // a file that is rewritten soon after being indexed might not be
+  // noticed, if its size did not change. The hash guards against this
+  // for the configuration text at the start of the file.
+  FILE *fp = fopen(data_name, "rb");
+  if (!fp)
+    return 1;
+  unsigned char buf[4096];
+  unsigned long long h = 14695981039346656037ULL;
+  size_t total = 0, n;
+  while (total < HASHED && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    for (size_t i = 0; i < n && total < HASHED; i++, total++) {
+      h ^= buf[i];
+      h *= 1099511628211ULL;
+    }
+  }
+  fclose(fp);
+  *hash = h;
+  return 0;
+}
+
+static void put_le(unsigned char *p, unsigned long long value, int n)
+{
+  for (int i = 0; i < n; i++) {
+    p[i] = (unsigned char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+static unsigned long long get_le(const unsigned char *p, int n)
+{
+  unsigned long long value = 0;
+  for (int i = n - 1; i >= 0; i--)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+int ad2cp_index_read(const char *index_name, const char *data_name, ad2cp_index& index)
+{
+  long long size, mtime;
+  unsigned long long hash;
+  if (data_file_signature(data_name, &size, &mtime, &hash))
+    return 1;
+  FILE *fp = fopen(index_name, "rb");
+  if (!fp)
+    return 1;
+  unsigned char header[HEADER];
+  if (HEADER != fread(header, 1, HEADER, fp)
+      || memcmp(header, MAGIC, 8)
+      || (long long)get_le(header + 8, 8) != size
+      || (long long)get_le(header + 16, 8) != mtime
+      || get_le(header + 24, 8) != hash) {
+    fclose(fp);
+    return 1;
+  }
+  index.early_EOF = (int)get_le(header + 32, 8);
+  unsigned long long nfailures = get_le(header + 40, 8);
+  unsigned long long n = get_le(header + 48, 8);
+  // each record takes at least 10 bytes, and the locator gives up after
+  // about 100 checksum failures
+  if (n > (unsigned long long)size / 10 || nfailures > 1000) {
+    fclose(fp);
+    return 1;
+  }
+  index.checksum_failures.resize((size_t)nfailures);
+  unsigned char record[RECORD];
+  for (unsigned long long i = 0; i < nfailures; i++) {
+    if (8 != fread(record, 1, 8, fp)) {
+      fclose(fp);
+      index.checksum_failures.clear();
+      return 1;
+    }
+    index.checksum_failures[i] = (long long)get_le(record, 8);
+  }
+  index.entries.resize((size_t)n);
+  for (unsigned long long i = 0; i < n; i++) {
+    ad2cp_index_entry& e = index.entries[i];
+    if (RECORD != fread(record, 1, RECORD, fp)) {
+      fclose(fp);
+      index.entries.clear();
+      return 1;
+    }
+    e.start = (long long)get_le(record, 8);
+    e.index = (long long)get_le(record + 8, 8);
+    e.header_length = record[16];
+    e.id = record[17];
+    e.data_length = (unsigned int)get_le(record + 18, 4);
+    unsigned long long bits = get_le(record + 22, 8);
+    memcpy(&e.time, &bits, 8);
+    if (e.start < 0 || e.index != e.start + e.header_length || e.index + e.data_length > size) {
+      fclose(fp);
+      index.entries.clear();
+      return 1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+int ad2cp_index_write(const char *index_name, const char *data_name, const ad2cp_index& index)
+{
+  long long size, mtime;
+  unsigned long long hash;
+  if (data_file_signature(data_name, &size, &mtime, &hash))
+    return 1;
+  std::string tmp_name = std::string(index_name) + ".tmp";
+  FILE *fp = fopen(tmp_name.c_str(), "wb");
+  if (!fp)
+    return 1;
+  unsigned char header[HEADER];
+  memcpy(header, MAGIC, 8);
+  put_le(header + 8, (unsigned long long)size, 8);
+  put_le(header + 16, (unsigned long long)mtime, 8);
+  put_le(header + 24, hash, 8);
+  put_le(header + 32, (unsigned long long)index.early_EOF, 8);
+  put_le(header + 40, (unsigned long long)index.checksum_failures.size(), 8);
+  put_le(header + 48, (unsigned long long)index.entries.size(), 8);
+  int bad = HEADER != fwrite(header, 1, HEADER, fp);
+  unsigned char record[RECORD];
+  for (size_t i = 0; !bad && i < index.checksum_failures.size(); i++) {
+    put_le(record, (unsigned long long)index.checksum_failures[i], 8);
+    bad = 8 != fwrite(record, 1, 8, fp);
+  }
+  for (size_t i = 0; !bad && i < index.entries.size(); i++) {
+    const ad2cp_index_entry& e = index.entries[i];
+    put_le(record, (unsigned long long)e.start, 8);
+    put_le(record + 8, (unsigned long long)e.index, 8);
+    record[16] = (unsigned char)e.header_length;
+    record[17] = (unsigned char)e.id;
+    put_le(record + 18, e.data_length, 4);
+    unsigned long long bits;
+    memcpy(&bits, &e.time, 8);
+    put_le(record + 22, bits, 8);
+    bad = RECORD != fwrite(record, 1, RECORD, fp);
+  }
+  if (fclose(fp))
+    bad = 1;
+  if (!bad) {
+    remove(index_name); // rename() will not replace a file on Windows
+    bad = rename(tmp_name.c_str(), index_name);
+  }
+  if (bad)
+    remove(tmp_name.c_str());
+  return bad;
+}
@@ -0,0 +1,53 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Index ("sidecar") files for Nortek AD2CP data files.
+//
+// As for RDI files (see rdi_index.h), records in an AD2CP file can
+// only be found by a scan from the start of the file, and the scan
+// also checksums every record. Files from long deployments may be
+// several GB, and read.adp.ad2cp() is often called several times on
+// the same file, for different values of 'dataType', so an index
+// file, named by appending ".oceidx" to the data-file name, records
+// the result of a full scan. The index holds every record, of every
+// type, so that any selection can be made from it.
+//
+// The index holds the size and modification time of the data file,
+// and a hash of its first bytes (which hold the configuration text),
+// and it is ignored if any of these has changed. It also holds the
+// file offsets at which checksum failures were found, and whether the
+// file ended in the middle of a record, so that these can be reported
+// when the index is used.
+//
+// Like mapped_file.h, this file does not include any R headers, and
+// problems are reported through return values.
+
+#ifndef OCE_AD2CP_INDEX_H
+#define OCE_AD2CP_INDEX_H
+
+#include <vector>
+
+typedef struct {
+  long long start;          // file offset of the header (0xa5 byte)
+  long long index;          // file offset of the data record
+  unsigned int header_length;
+  unsigned int data_length;
+  unsigned int id;          // record type, e.g. 0x16 for average
+  double time;              // seconds since 1970-01-01 UTC, or NaN
+} ad2cp_index_entry;
+
+typedef struct {
+  std::vector<ad2cp_index_entry> entries;
+  std::vector<long long> checksum_failures; // file offsets
+  int early_EOF;
+} ad2cp_index;
+
+// Read an index, returning 0 on success, or nonzero if the index does
+// not exist, cannot be read, or does not match the data file.
+int ad2cp_index_read(const char *index_name, const char *data_name, ad2cp_index& index);
+
+// Write an index, returning 0 on success, or nonzero on failure (e.g.
+// if the directory is not writable). As with rdi_index_write(), a
+// temporary file is renamed, so that a partial index is never seen.
+int ad2cp_index_write(const char *index_name, const char *data_name, const ad2cp_index& index);
+
+#endif
@@ -0,0 +1,124 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Reading SonTek ADV data in serial format, i.e. a stream of 22-byte
+// records as described in ldc_sontek_adv_22() in bitwise.c, perhaps
+// chopped by a data logger into a series of files.
+//
+// The files are read through MappedFile (see mapped_file.h) as one
+// stream of bytes, so they are never concatenated in memory, and a
+// record that was split between two files is still found. Records
+// are located and decoded in a single pass.
+
+#include <Rcpp.h>
+#include <string>
+#include <vector>
+#include "checksum.h"
+#include "mapped_file.h"
+using namespace Rcpp;
+
+#define ADV_RECORD_LENGTH 22
+
+// Cross-reference work:
+// 1. update ../src/registerDynamicSymbol.c with an item for this
+// 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
+//
+// [[Rcpp::export]]
+List do_adv_sontek_serial_files(StringVector filename)
+{
+  // Arguments:
+  //   filename = names of the files, in order
+  // The result is a list holding the sample numbers (unwrapped from
+  // their 16-bit form, so that they increase through the whole
+  // stream), the velocities (m/s), amplitudes and correlations (as
+  // matrices with a column per beam), temperature (degC) and pressure
+  // (counts).
+  if (filename.size() < 1)
+    ::Rf_error("must give at least one file name");
+  MappedFile mf;
+  std::vector<std::string> fns(filename.size());
+  std::vector<const char *> fnp(filename.size());
+  for (int i = 0; i < filename.size(); i++) {
+    fns[i] = Rcpp::as<std::string>(filename(i));
+    fnp[i] = fns[i].c_str();
+  }
+  int open_failure = mf.open(&fnp[0], (int)fnp.size());
+  if (open_failure)
+    ::Rf_error("cannot open file '%s'\n", fnp[open_failure - 1]);
+  unsigned char byte1 = 0x85;
+  unsigned char byte2 = ADV_RECORD_LENGTH;
+  unsigned short int check_sum_start = ((unsigned short)0xa5<<8)  | ((unsigned short)0x96); /* manual p96 says 0xA596; assume little-endian */
+  // The files hold little else than records, so this is a close upper
+  // bound on their number, and the columns need not be regrown.
+  long long size = mf.size();
+  size_t nmax = (size_t)(size / ADV_RECORD_LENGTH);
+  std::vector<unsigned short> sample;
+  std::vector<short> velocity, temperature;
+  std::vector<unsigned short> pressure;
+  std::vector<unsigned char> amplitude, correlation;
+  sample.reserve(nmax);
+  velocity.reserve(3 * nmax);
+  amplitude.reserve(3 * nmax);
+  correlation.reserve(3 * nmax);
+  temperature.reserve(nmax);
+  pressure.reserve(nmax);
+  long long pos = 0;
+  while (pos < size - 1) {
+    // Search file by file, checking for a key pair that is split
+    // between two files.
+    long long n = mf.run(pos);
+    const unsigned char *p = mf.span(pos, n);
+    if (!p)
+      break;
+    long long k = find_byte_pair(p, n, byte1, byte2);
+    if (k < 0) {
+      if (pos + n >= size)
+        break;
+      if (p[n - 1] != byte1 || mf.byte(pos + n) != byte2) {
+        pos += n;
+        continue;
+      }
+      k = n - 1;
+    }
+    long long start = pos + k;
+    const unsigned char *r = mf.span(start, ADV_RECORD_LENGTH);
+    if (!r)
+      break;
+    unsigned short int desired_check_sum = ((unsigned short)r[20]) | ((unsigned short)r[21] << 8);
+    if (desired_check_sum != oce_checksum_bytes(r, 20, check_sum_start)) {
+      pos = start + 1;
+      continue;
+    }
+    sample.push_back((unsigned short)(r[2] | (r[3] << 8)));
+    for (int b = 0; b < 3; b++) {
+      velocity.push_back((short)(r[4+2*b] | (r[5+2*b] << 8)));
+      amplitude.push_back(r[10+b]);
+      correlation.push_back(r[13+b]);
+    }
+    temperature.push_back((short)(r[16] | (r[17] << 8)));
+    pressure.push_back((unsigned short)(r[18] | (r[19] << 8)));
+    pos = start + ADV_RECORD_LENGTH;
+  }
+  mf.close();
+  R_xlen_t len = sample.size();
+  NumericVector sampleNumber(len), temperatureOut(len), pressureOut(len);
+  NumericMatrix v(len, 3);
+  RawMatrix a(len, 3), q(len, 3);
+  // Sample numbers wrap at 65535, as in unwrap_sequence_numbers() in
+  // bitwise.c.
+  double cumulative = 0.0;
+  for (R_xlen_t i = 0; i < len; i++) {
+    if (i > 0 && sample[i] < sample[i-1])
+      cumulative += 65536.0;
+    sampleNumber[i] = sample[i] + cumulative;
+    for (int b = 0; b < 3; b++) {
+      v(i, b) = 1e-4 * velocity[3*i+b];
+      a(i, b) = amplitude[3*i+b];
+      q(i, b) = correlation[3*i+b];
+    }
+    temperatureOut[i] = 0.01 * temperature[i];
+    pressureOut[i] = pressure[i];
+  }
+  return(List::create(Named("sampleNumber")=sampleNumber, Named("v")=v,
+        Named("a")=a, Named("q")=q, Named("temperature")=temperatureOut,
+        Named("pressure")=pressureOut));
+}
@@ -1,8 +1,46 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
 
 #include <Rcpp.h>
+#include <string.h>
 using namespace Rcpp;
 
+// Times of the velocity data (vvd) of a continuously-sampled Vector
+// file, found by left-bracketing each with the preceding system data
+// (vsd) record, and stepping forward thereafter in times dt. Both sets
+// of starts must be in increasing order.
+static void adv_vector_continuous_time(const double *vvdStart, R_xlen_t nvvd,
+    const double *vsdStart, const double *vsdTime, R_xlen_t nvsd, double dt, double *res)
+{
+  if (nvvd < 1)
+    return;
+  // 1. Move vsd pointer to point at vsd entry just preceding first vvd entry.
+  R_xlen_t ivvd, ivsd=0;
+#ifdef DEBUG
+  Rprintf("continuous sampling\n");
+  Rprintf("vvdStart[0]=%f\n", vvdStart[0]);
+  Rprintf("vsdStart[0]=%f\n", vsdStart[0]);
+#endif
+  while(vvdStart[0] > vsdStart[ivsd]) {
+    if (++ivsd >= nvsd)
+      ::Rf_error("cannot interpret times for velocities, because no Vector System Data precede first velocity datum");
+  }
+  if (ivsd > 0)
+    ivsd--;
+#ifdef DEBUG
+  Rprintf("got ivsd=%lld\n", (long long)ivsd);
+#endif
+  // 2. step through vvd, updating left-neighbor vsd when necessary
+  double toffset = 0.0;
+  for (ivvd = 0; ivvd < nvvd; ivvd++) {
+    if (ivsd < (nvsd - 1) && vsdStart[ivsd+1] < vvdStart[ivvd]) {
+      ivsd++; // enter new time era
+      toffset = 0.0;
+    }
+    res[ivvd] = vsdTime[ivsd] + toffset;
+    toffset += dt;
+  }
+}
+
 // Cross-reference work:
 // 1. update ../src/registerDynamicSymbol.c with an item for this
 // 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
@@ -10,7 +48,8 @@ using namespace Rcpp;
 // [[Rcpp::export]]
 NumericVector do_adv_vector_time(NumericVector vvdStart, NumericVector vsdStart, NumericVector vsdTime, NumericVector vvdhStart, NumericVector vvdhTime, NumericVector n, NumericVector f)
 {
-  // This is called by read.adv.nortek(), in adv.nortek.R, with arguments as follows
+  // This was called by read.adv.nortek(), in adv.nortek.R, which now
+  // uses do_adv_vector_decode() instead. The arguments are as follows
   //   vvdStart = indices of 'vector velocity data' (0xA5 ox10)
   //   vvdhStart = indices of headers for 'vector velocity data header' (0xA5 ox10)
   //   vvdhTime = POSIX times of vvdh
@@ -39,38 +78,7 @@ NumericVector do_adv_vector_time(NumericVector vvdStart, NumericVector vsdStart,
   double dt =  1.0 / f[0];
   if (nn == 0) {
     // Continuous sampling
-    //
-    // 1. Move vsd pointer to point at vsd entry just preceding first vvd entry.
-    int ivvd, ivsd=0;
-#ifdef DEBUG
-    Rprintf("continuous sampling\n");
-    Rprintf("vvdStart[0]=%f\n", vvdStart[0]);
-    Rprintf("vsdStart[0]=%f\n", vsdStart[0]);
-#endif
-    while(vvdStart[0] > vsdStart[ivsd]) {
-      if (++ivsd >= nvsd)
-        ::Rf_error("cannot interpret times for velocities, because no Vector System Data precede first velocity datum");
-#ifdef DEBUG
-      Rprintf("ivsd=%d\n", ivsd);
-#endif
-    }
-    if (ivsd > 0)
-      ivsd--;
-#ifdef DEBUG
-    Rprintf("got ivsd=%d\n",ivsd);
-    Rprintf("vvdStart[0]=%f\n", vvdStart[0]);
-    Rprintf("vsdStart[%d]=%f\n", ivsd, vsdStart[ivsd]);
-#endif
-    // 2. step through vvd, updating left-neighbor vsd when necessary
-    double toffset = 0.0;
-    for (ivvd = 0; ivvd < nvvd; ivvd++) {
-      if (ivsd < (nvsd - 1) && vsdStart[ivsd+1] < vvdStart[ivvd]) {
-        ivsd++; // enter new time era
-        toffset = 0.0;
-      }
-      res[ivvd] = vsdTime[ivsd] + toffset;
-      toffset += dt;
-    }
+    adv_vector_continuous_time(vvdStart.begin(), nvvd, vsdStart.begin(), vsdTime.begin(), nvsd, dt, res.begin());
   } else {
     // Burst sampling
 #ifdef DEBUG
@@ -107,3 +115,198 @@ NumericVector do_adv_vector_time(NumericVector vvdStart, NumericVector vsdStart,
   }
   return(res);
 }
+
+// Decode the records of a Nortek Vector file, for read.adv.nortek(), in
+// a single pass, with arguments as follows
+//   buf = the file contents
+//   vvdStart = indices of the 'vector velocity data' to decode (1-based)
+//   vsdStart = indices of the 'vector system data' to decode (1-based)
+//   vsdTime = POSIX times of vsd
+//   vvdhTime = POSIX times of all 'vector velocity data header' records
+//   vvdhRecords = number of samples in each burst
+//   look = indices of vvdStart within the series of burst samples
+//   velocityScale = velocity scale, in m/s
+//   f = sampling rate in Hz
+// The result holds the velocity-data fields (v, a, q, pressure, analog1,
+// analog2 and time) and the system-data fields (voltage, heading, pitch,
+// roll and temperature), scaled as in read.adv.nortek(). The times are
+// found as by do_adv_vector_time() for continuous sampling. For burst
+// sampling, sample 'look[i]' of the series formed by stepping through
+// each burst from its header time, in steps of 1/f, is offset by the
+// warmup delay that Nortek recommends.
+//
+// [[Rcpp::export]]
+List do_adv_vector_decode(RawVector buf, NumericVector vvdStart, NumericVector vsdStart, NumericVector vsdTime, NumericVector vvdhTime, NumericVector vvdhRecords, NumericVector look, NumericVector velocityScale, NumericVector f)
+{
+  R_xlen_t nbuf = buf.size(), nvvd = vvdStart.size(), nvsd = vsdStart.size();
+  if (vsdTime.size() != nvsd)
+    ::Rf_error("vsdTime has length %lld but vsdStart has length %lld", (long long)vsdTime.size(), (long long)nvsd);
+  if (vvdhTime.size() != vvdhRecords.size())
+    ::Rf_error("vvdhTime has length %lld but vvdhRecords has length %lld", (long long)vvdhTime.size(), (long long)vvdhRecords.size());
+  if (look.size() != nvvd)
+    ::Rf_error("look has length %lld but vvdStart has length %lld", (long long)look.size(), (long long)nvvd);
+  if (f[0] <= 0)
+    ::Rf_error("f (sampling frequency) must be positive, but got %f", f[0]);
+  double scale = velocityScale[0], dt = 1.0 / f[0];
+  const unsigned char *b = &buf[0];
+  NumericMatrix v(nvvd, 3);
+  RawMatrix a(nvvd, 3), q(nvvd, 3);
+  NumericVector pressure(nvvd), time(nvvd);
+  IntegerVector analog1(nvvd), analog2(nvvd);
+  for (R_xlen_t i = 0; i < nvvd; i++) {
+    // offsets and scales are as on p35 of the System Integrator Guide
+    R_xlen_t start = (R_xlen_t)vvdStart[i] - 1;
+    if (start < 0 || start + 24 > nbuf)
+      ::Rf_error("vvdStart[%lld]=%.0f is not within the buffer", (long long)i + 1, vvdStart[i]);
+    const unsigned char *r = b + start;
+    analog2[i] = r[2] | (r[5] << 8);
+    pressure[i] = (65536.0 * r[4] + (r[6] | (r[7] << 8))) / 1000;
+    analog1[i] = r[8] | (r[9] << 8);
+    for (int j = 0; j < 3; j++) {
+      v(i, j) = scale * (short)(r[10 + 2 * j] | (r[11 + 2 * j] << 8));
+      a(i, j) = r[16 + j];
+      q(i, j) = r[19 + j];
+    }
+  }
+  double burstTotal = 0;
+  for (R_xlen_t ib = 0; ib < vvdhRecords.size(); ib++)
+    burstTotal += vvdhRecords[ib];
+  if (burstTotal > 0) {
+    // Burst sampling. The samples of the bursts form a series that 'look'
+    // indexes, as it increases.
+    double delayForWarmup = 2 + 1 / (f[0] * 2); // FIXME: this is from a forum posting, not an official doc.
+    R_xlen_t ib = 0, nb = vvdhRecords.size();
+    double before = 0; // samples in bursts preceding burst ib
+    for (R_xlen_t i = 0; i < nvvd; i++) {
+      double k = floor(look[i]) - 1; // as R truncates indices
+      if (ISNAN(k) || k < 0) {
+        time[i] = NA_REAL;
+        continue;
+      }
+      if (k < before) { // 'look' is normally increasing, but start over if not
+        ib = 0;
+        before = 0;
+      }
+      while (ib < nb && k >= before + vvdhRecords[ib])
+        before += vvdhRecords[ib++];
+      time[i] = ib < nb ? (vvdhTime[ib] + (k - before) * dt) + delayForWarmup : NA_REAL;
+    }
+  } else {
+    adv_vector_continuous_time(vvdStart.begin(), nvvd, vsdStart.begin(), vsdTime.begin(), nvsd, dt, time.begin());
+  }
+  NumericVector voltage(nvsd), heading(nvsd), pitch(nvsd), roll(nvsd), temperature(nvsd);
+  for (R_xlen_t i = 0; i < nvsd; i++) {
+    // offsets and scales are as on p36 of the System Integrator Guide
+    R_xlen_t start = (R_xlen_t)vsdStart[i] - 1;
+    if (start < 0 || start + 28 > nbuf)
+      ::Rf_error("vsdStart[%lld]=%.0f is not within the buffer", (long long)i + 1, vsdStart[i]);
+    const unsigned char *r = b + start;
+    voltage[i] = 0.1 * (unsigned short)(r[10] | (r[11] << 8));
+    heading[i] = 0.1 * (short)(r[14] | (r[15] << 8));
+    pitch[i] = 0.1 * (short)(r[16] | (r[17] << 8));
+    roll[i] = 0.1 * (short)(r[18] | (r[19] << 8));
+    temperature[i] = 0.01 * (short)(r[20] | (r[21] << 8));
+  }
+  return(List::create(Named("v")=v, Named("a")=a, Named("q")=q,
+        Named("pressure")=pressure, Named("analog1")=analog1,
+        Named("analog2")=analog2, Named("time")=time,
+        Named("voltage")=voltage, Named("heading")=heading,
+        Named("pitch")=pitch, Named("roll")=roll,
+        Named("temperature")=temperature));
+}
+
+// Little-endian single-precision value, as readBin(..., "numeric", size=4).
+static double imu_float(const unsigned char *p)
+{
+  unsigned int u = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+  float f;
+  memcpy(&f, &u, 4);
+  return (double)f;
+}
+
+// Decode the IMU (inertial motion unit) records of a Nortek Vector
+// file, for read.adv.nortek(), with arguments as follows
+//   buf = the file contents
+//   imuStart = indices of the records, from locate_vector_imu_sequences()
+// The type of the records is taken from the first; records of other
+// types yield NA. The result has an element for each column of the
+// 'data' slot, named as in read.adv.nortek(), with IMUrotation (for
+// types 0xc3 and 0xcc) being a 3x3xn array. The layouts are described
+// in references [1B] and [1C] of ?read.adv.
+//
+// [[Rcpp::export]]
+List do_adv_vector_imu(RawVector buf, NumericVector imuStart)
+{
+  R_xlen_t nbuf = buf.size(), n = imuStart.size();
+  if (n < 1)
+    ::Rf_error("no IMU records");
+  const unsigned char *b = &buf[0];
+  R_xlen_t start0 = (R_xlen_t)imuStart[0] - 1;
+  if (start0 < 0 || start0 + 6 > nbuf)
+    ::Rf_error("imuStart[1]=%.0f is not within the buffer", imuStart[0]);
+  unsigned char type = b[start0 + 5];
+  // Names of the vector fields, which start at offset 6 and hold
+  // 3 values each, and the offsets of the rotation matrix (or 0, if
+  // there is none) and of the timestamp.
+  const char *vectors[3];
+  int rotationOffset = 0, timeOffset = 0, length = 0;
+  if (type == 0xc3) {
+    vectors[0] = "IMUdeltaAngle"; vectors[1] = "IMUdeltaVelocity"; vectors[2] = NULL;
+    rotationOffset = 30;
+    timeOffset = 66;
+    length = 72;
+  } else if (type == 0xcc) {
+    vectors[0] = "IMUaccel"; vectors[1] = "IMUangrt"; vectors[2] = "IMUmagrt";
+    rotationOffset = 42;
+    timeOffset = 78;
+    length = 86;
+  } else if (type == 0xd2) {
+    vectors[0] = "IMUaccel"; vectors[1] = "IMUangrt"; vectors[2] = "IMUmagrt";
+    timeOffset = 42;
+    length = 50;
+  } else if (type == 0xd3) {
+    vectors[0] = "IMUdeltaAngle"; vectors[1] = "IMUdeltaVelocity"; vectors[2] = "IMUdeltaMagVector";
+    timeOffset = 42;
+    length = 50;
+  } else {
+    ::Rf_error("unknown IMU type 0x%02x; only 0xc3, 0xcc, 0xd2 and 0xd3 are recognized", type);
+  }
+  int nvectors = vectors[2] ? 3 : 2;
+  std::vector<NumericVector> columns;
+  for (int k = 0; k < 3 * nvectors; k++)
+    columns.push_back(NumericVector(n, NA_REAL));
+  NumericVector rotation(rotationOffset ? 9 * n : 0, NA_REAL), time(n, NA_REAL);
+  for (R_xlen_t i = 0; i < n; i++) {
+    R_xlen_t start = (R_xlen_t)imuStart[i] - 1;
+    if (start < 0 || start + length > nbuf || b[start + 5] != type)
+      continue;
+    const unsigned char *r = b + start;
+    for (int k = 0; k < 3 * nvectors; k++)
+      columns[k][i] = imu_float(r + 6 + 4 * k);
+    // The matrix is stored by rows.
+    for (int row = 0; rotationOffset && row < 3; row++)
+      for (int col = 0; col < 3; col++)
+        rotation[row + 3 * col + 9 * i] = imu_float(r + rotationOffset + 4 * (3 * row + col));
+    // a "tick" of the internal timestamp clock is 16 microseconds [IMU p 78]
+    int ticks = (int)(r[timeOffset] | (r[timeOffset + 1] << 8) | (r[timeOffset + 2] << 16) | ((unsigned int)r[timeOffset + 3] << 24));
+    time[i] = ticks == NA_INTEGER ? NA_REAL : ticks / 62500.0;
+  }
+  int ncolumns = 3 * nvectors + (rotationOffset ? 1 : 0) + 1;
+  List res(ncolumns);
+  CharacterVector names(ncolumns);
+  const char *xyz[3] = {"X", "Y", "Z"};
+  int icolumn = 0;
+  for (int k = 0; k < 3 * nvectors; k++) {
+    res[icolumn] = columns[k];
+    names[icolumn++] = std::string(vectors[k / 3]) + xyz[k % 3];
+  }
+  if (rotationOffset) {
+    rotation.attr("dim") = IntegerVector::create(3, 3, (int)n);
+    res[icolumn] = rotation;
+    names[icolumn++] = "IMUrotation";
+  }
+  res[icolumn] = time;
+  names[icolumn++] = "IMUtime";
+  res.attr("names") = names;
+  return(res);
+}
@@ -9,6 +9,8 @@
 #include <R.h>
 #include <Rdefines.h>
 #include <Rinternals.h>
+#include <string.h>
+#include "checksum.h"
 
 //#define DEBUG
 
@@ -126,28 +128,27 @@ pressure <- readBin(buf[sort(c(p, p+1))+18], "integer", signed=TRUE, size=2, end
   /* FIXME: check lengths of match and key */
   pbuf = RAW_POINTER(buf);
   int max_lres = *INTEGER_POINTER(max);
-  int lres;
-  int lbuf = LENGTH(buf);
+  R_xlen_t lres;
+  R_xlen_t lbuf = XLENGTH(buf);
   SEXP res;
 #ifdef DEBUG
-  Rprintf("lbuf=%d, max=%d\n",lbuf,max_lres);
+  Rprintf("lbuf=%lld, max=%d\n",(long long)lbuf,max_lres);
 #endif
   /* Count matches, so we can allocate the right length */
   unsigned char byte1 = 0x85;
   unsigned char byte2 = 0x16; /* this equal 22 base 10, i.e. the number of bytes in record */
-  unsigned int matches = 0;
+  R_xlen_t matches = 0;
   unsigned short int check_sum_start = ((unsigned short)0xa5<<8)  | ((unsigned short)0x96); /* manual p96 says 0xA596; assume little-endian */
   unsigned short int check_sum, desired_check_sum;
   if (max_lres < 0)
     max_lres = 0;
-  for (int i = 0; i < lbuf - byte2; i++) { /* note that we don't look to the very end */
+  for (R_xlen_t i = 0; i < lbuf - byte2; i++) { /* note that we don't look to the very end */
     check_sum = check_sum_start;
     if (pbuf[i] == byte1 && pbuf[i+1] == byte2) { /* match first 2 bytes, now check the checksum */
 #ifdef DEBUG
-      Rprintf("tentative match %d at i = %d ... ", matches, i);
+      Rprintf("tentative match %lld at i = %lld ... ", (long long)matches, (long long)i);
 #endif
-      for (int c = 0; c < 20; c++)
-        check_sum += (unsigned short int)pbuf[i + c];
+      check_sum = oce_checksum_bytes(pbuf + i, 20, check_sum);
       desired_check_sum = ((unsigned short)pbuf[i+20]) | ((unsigned short)pbuf[i+21] << 8);
       if (check_sum == desired_check_sum) {
         matches++;
@@ -166,17 +167,16 @@ pressure <- readBin(buf[sort(c(p, p+1))+18], "integer", signed=TRUE, size=2, end
   /* allocate space, then run through whole buffer again, noting the matches */
   lres = matches;
   if (lres > 0) {
-    PROTECT(res = NEW_INTEGER(lres));
-    int *pres = INTEGER_POINTER(res);
+    PROTECT(res = NEW_NUMERIC(lres));
+    double *pres = NUMERIC_POINTER(res);
 #ifdef DEBUG
-    Rprintf("getting space for %d matches\n", lres);
+    Rprintf("getting space for %lld matches\n", (long long)lres);
 #endif
-    unsigned int ires = 0;
-    for (int i = 0; i < lbuf - byte2; i++) { /* note that we don't look to the very end */
+    R_xlen_t ires = 0;
+    for (R_xlen_t i = 0; i < lbuf - byte2; i++) { /* note that we don't look to the very end */
       check_sum = check_sum_start;
       if (pbuf[i] == byte1 && pbuf[i+1] == byte2) { /* match first 2 bytes, now check the checksum */
-        for (int c = 0; c < 20; c++)
-          check_sum += (unsigned short int)pbuf[i + c];
+        check_sum = oce_checksum_bytes(pbuf + i, 20, check_sum);
         desired_check_sum = ((unsigned short)pbuf[i+20]) | ((unsigned short)pbuf[i+21] << 8);
         if (check_sum == desired_check_sum) {
           pres[ires++] = i + 1; /* the +1 is to get R pointers */
@@ -188,8 +188,8 @@ pressure <- readBin(buf[sort(c(p, p+1))+18], "integer", signed=TRUE, size=2, end
     UNPROTECT(3);
     return(res);
   } else {
-    PROTECT(res = NEW_INTEGER(1));
-    int *pres = INTEGER_POINTER(res);
+    PROTECT(res = NEW_NUMERIC(1));
+    double *pres = NUMERIC_POINTER(res);
     pres[0] = 0;
     UNPROTECT(3);
     return(res);
@@ -210,7 +210,7 @@ SEXP nortek_checksum(SEXP buf, SEXP key)
      vvd.start <- matchBytes(buf, 0xa5, 0x10)
      ok <- NULL;dyn.load("~/src/R-kelley/oce/src/bitwise.so");for(i in 1:200) {ok <- c(ok, .Call("nortek_checksum",buf[vvd.start[i]+0:23], c(0xb5, 0x8c)))}
      */
-  int i, n;
+  int n;
   short check_value;
   int *resp;
   unsigned char *bufp, *keyp;
@@ -232,16 +232,12 @@ SEXP nortek_checksum(SEXP buf, SEXP key)
   Rprintf("check_value= %d\n", check_value);
   Rprintf("n=%d\n", n);
 #endif
-  short *sbufp = (short*) bufp;
-  for (i = 0; i < (n - 2)/2; i++) {
+  /* sum the little-endian 16-bit words that precede the checksum */
+  if (n > 2)
+    check_value = (short)oce_checksum_words(bufp, 2 * ((n - 2) / 2), (unsigned short)check_value);
 #ifdef DEBUG
-    Rprintf("i=%d buf=0x%02x\n", i, sbufp[i]);
+  Rprintf("after, check_value=%d\n", check_value);
 #endif
-    check_value += sbufp[i];
-#ifdef DEBUG
-    Rprintf("after, check_value=%d\n", check_value);
-#endif
-  }
   short checksum;
   checksum = (((short)bufp[n-1]) << 8) | (short)bufp[n-2];
 #ifdef DEBUG
@@ -257,7 +253,8 @@ SEXP nortek_checksum(SEXP buf, SEXP key)
 
 SEXP match2bytes(SEXP buf, SEXP m1, SEXP m2, SEXP demand_sequential)
 {
-  int i, j, n, n_match, ds;
+  R_xlen_t i, j, n, n_match;
+  int ds;
   double *resp;
   unsigned char *bufp, *m1p, *m2p;
   SEXP res;
@@ -269,7 +266,7 @@ SEXP match2bytes(SEXP buf, SEXP m1, SEXP m2, SEXP demand_sequential)
   m1p = RAW_POINTER(m1);
   m2p = RAW_POINTER(m2);
   ds = *INTEGER(demand_sequential);
-  n = LENGTH(buf);
+  n = XLENGTH(buf);
   unsigned short seq_last=0, seq_this;
   // Rprintf("demand_sequential=%d\n",ds);
   //int nnn=10;
@@ -379,49 +376,56 @@ SEXP locate_vector_imu_sequences(SEXP buf)
   PROTECT(buf = AS_RAW(buf));
   unsigned char *bufp;
   bufp = RAW_POINTER(buf);
-  int bufn = LENGTH(buf);
-  SEXP res;
-  PROTECT(res = NEW_INTEGER(bufn)); // definitely more than enough space
-  int *resp = INTEGER_POINTER(res);
-  int resn = 0;
-  //int check=10; // check this many instance of 0xa5,0x71
+  R_xlen_t bufn = XLENGTH(buf);
+  // The starts are stored in a buffer that grows as needed, so that
+  // memory is proportional to the number of IMU records, not to the
+  // size of the file.
+  R_xlen_t resn = 0, resalloc = 1024;
+  double *resp = R_Calloc(resalloc, double);
   // We check 5 bytes, on the assumption that false positives will be
   // effectively zero then (1e-12, if independent random numbers
   // in range 0 to 255).
   // FIXME: test the checksum, but SIG2 does not state how.
-  for (int i = 0; i < bufn-1; i++) {
-    if (bufp[i] == 0xa5 && bufp[i+1] == 0x71) {
-      //if (check-- > 0) Rprintf("IMU test: buf[%d]=0x%02x, buf[%d+2]=0x%02x, buf[%d+5]=0x%02x\n", i, bufp[i], i, bufp[i+2], i, bufp[i+5]);
-      // Check at offset=5, which must be 1 of 3 choices.
+  R_xlen_t i = 0;
+  while (i < bufn - 5) {
+    unsigned char *p = (unsigned char *)memchr(bufp + i, 0xa5, bufn - 5 - i);
+    if (!p)
+      break;
+    i = p - bufp;
+    if (bufp[i+1] == 0x71) {
+      // Check at offset=5, which must be 1 of 4 choices, each with its
+      // own length indication (in 2-byte words).
+      int found = 0;
       if (bufp[i+5] == 0xc3) {
         // FIXME: should verify this length check, which I got by inspecting dolfyn code
         // and a file provided privately in March 2016.
-        if (bufp[i+2] == 0x24 && bufp[i+3] == 0x00) {
-          resp[resn++] = i + 1; // add 1 for R notation
-          i++; //FIXME: skip to end, when we really trust identification
-        }
+        found = bufp[i+2] == 0x24 && bufp[i+3] == 0x00;
       } else if (bufp[i+5] == 0xcc) {
         // length indication should be 0x2b=43=86/2 (SIG2, top of page 31)
-        if (bufp[i+2] == 0x2b && bufp[i+3] == 0x00) {
-          resp[resn++] = i + 1; // add 1 for R notation
-          i++; //FIXME: skip to end, when we really trust identification
-        }
+        found = bufp[i+2] == 0x2b && bufp[i+3] == 0x00;
       } else if (bufp[i+5] == 0xd2) { // decimal 210
         // length indication should be 0x19=25=50/2 (SIG2, middle of page 31)
-        if (bufp[i+2] == 0x19 && bufp[i+3] == 0x00) {
-          resp[resn++] = i + 1; // add 1 for R notation
-          i++; //FIXME: skip to end, when we really trust identification
-        }
-      } else if (bufp[i+5] ==0xd3) { // decimal 211
+        found = bufp[i+2] == 0x19 && bufp[i+3] == 0x00;
+      } else if (bufp[i+5] == 0xd3) { // decimal 211
         // length indication should be 0x19=25=50/2 (SIG2, page 32)
-        if (bufp[i+2] == 0x19 && bufp[i+3] == 0x00) {
-          resp[resn++] = i + 1; // add 1 for R notation
-          i++; //FIXME: skip to end, when we really trust identification
+        found = bufp[i+2] == 0x19 && bufp[i+3] == 0x00;
+      }
+      if (found) {
+        if (resn == resalloc) {
+          resalloc *= 2;
+          resp = R_Realloc(resp, resalloc, double);
         }
+        resp[resn++] = i + 1; // add 1 for R notation
+        i++; //FIXME: skip to end, when we really trust identification
       }
     }
+    i++;
   }
-  SET_LENGTH(res, resn);
+  SEXP res;
+  PROTECT(res = NEW_NUMERIC(resn));
+  if (resn > 0)
+    memcpy(NUMERIC_POINTER(res), resp, resn * sizeof(double));
+  R_Free(resp);
   UNPROTECT(2);
   return(res);
 }
@@ -469,22 +473,22 @@ SEXP locate_byte_sequences(SEXP buf, SEXP match, SEXP len, SEXP key, SEXP max)
   Rprintf("lsequence=%d\n",lsequence);
 #endif
   int lmatch = LENGTH(match);
-  int lbuf = LENGTH(buf);
+  R_xlen_t lbuf = XLENGTH(buf);
   int lkey = LENGTH(key);
   if (lkey != 2) error("key length must be 2");
-  int ires = 0, lres = (int)(lbuf / lsequence + 3); /* get some extra space; fill some with NA */
+  R_xlen_t ires = 0, lres = lbuf / lsequence + 3; /* get some extra space; fill some with NA */
   SEXP res;
 #ifdef DEBUG
-  Rprintf("lsequence=%d, lres=%d\n",lsequence,lres);
+  Rprintf("lsequence=%d, lres=%lld\n",lsequence,(long long)lres);
 #endif
   /* Rprintf("max_lres=%d\n", max_lres); */
   if (max_lres > 0)
     lres = max_lres;
-  PROTECT(res = NEW_INTEGER(lres));
-  int *pres = INTEGER_POINTER(res);
+  PROTECT(res = NEW_NUMERIC(lres));
+  double *pres = NUMERIC_POINTER(res);
   /* Count matches, so we can allocate the right length */
   short lsequence2 = lsequence / 2;
-  for (int i = 0; i < lbuf - lsequence; i++) {
+  for (R_xlen_t i = 0; i < lbuf - lsequence; i++) {
     short check_value = (((short)pkey[0]) << 8) | (short)pkey[1];
     int found = 0;
     for (int m = 0; m < lmatch; m++) {
@@ -494,16 +498,12 @@ SEXP locate_byte_sequences(SEXP buf, SEXP match, SEXP len, SEXP key, SEXP max)
         break;
     }
     if (found == lmatch) {
-      /* FIXME: should bit-twiddle this to work on all endian types */
-      short *check = (short*)(pbuf+i);
-      /*Rprintf(" %d", check_value);*/
-      for (int cc = 0; cc < lsequence2 - 1; cc++) { /* last 2-byte chunk is the test value */
-        check_value += *check++;
-        /*Rprintf(" %d", check_value);*/
-      }
+      /* last 2-byte chunk is the test value */
+      if (lsequence2 > 1)
+        check_value = (short)oce_checksum_words(pbuf + i, 2 * (lsequence2 - 1), (unsigned short)check_value);
       short check_sum = (((short)pbuf[i+lsequence-1]) << 8) | (short)pbuf[i+lsequence-2];
 #ifdef DEBUG
-      Rprintf("i=%d lbuf=%d ires=%d  lres=%d  check_value=%d vs check_sum %d match=%d\n", i, lbuf, ires, lres, check_value, check_sum, check_value==check_sum);
+      Rprintf("i=%lld lbuf=%lld ires=%lld  lres=%lld  check_value=%d vs check_sum %d match=%d\n", (long long)i, (long long)lbuf, (long long)ires, (long long)lres, check_value, check_sum, check_value==check_sum);
 #endif
       if (check_value == check_sum) {
         pres[ires++] = i + 1;
@@ -521,9 +521,122 @@ SEXP locate_byte_sequences(SEXP buf, SEXP match, SEXP len, SEXP key, SEXP max)
   return(res);
 }
 
+SEXP locate_byte_sequences_multi(SEXP buf, SEXP match, SEXP len, SEXP key)
+{
+  /*
+   * locate_byte_sequences_multi() = find several types of sequence in a
+   * single pass through the buffer, e.g. the velocity, system and header
+   * records of a nortek vector file, which would take a call each to
+   * locate_byte_sequences()
+   * buf = buffer to be scanned
+   * match = list of sets of bytes that mark start of sequences, one per
+   *         type; all must start with the same byte
+   * len = lengths of sequences, one per type
+   * key = list of keys added to checksums, one per type
+   * The value is a list holding, for each type, what locate_byte_sequences()
+   * would return with max=0.  The lead byte is found with memchr(), which is
+   * vectorized in most C libraries, so most of the buffer is not examined
+   * byte by byte.
+   */
+  /*
+     s <- .Call("locate_byte_sequences_multi", buf,
+         list(c(0xa5, 0x10), c(0xa5, 0x11), c(0xa5, 0x12)),
+         c(24, 28, 42), rep(list(c(0xb5, 0x8c)), 3))
+     */
+#define MAX_TYPES 16
+  PROTECT(buf = AS_RAW(buf));
+  PROTECT(len = AS_INTEGER(len));
+  int ntype = LENGTH(len);
+  if (!isNewList(match) || LENGTH(match) != ntype)
+    error("match must be a list with one element per element of len");
+  if (!isNewList(key) || LENGTH(key) != ntype)
+    error("key must be a list with one element per element of len");
+  if (ntype < 1 || ntype > MAX_TYPES)
+    error("must have between 1 and %d types of sequence", MAX_TYPES);
+  unsigned char *pbuf = RAW_POINTER(buf);
+  R_xlen_t lbuf = XLENGTH(buf);
+  unsigned char *pmatch[MAX_TYPES];
+  int lmatch[MAX_TYPES], lsequence[MAX_TYPES];
+  short check_key[MAX_TYPES];
+  R_xlen_t next[MAX_TYPES], ires[MAX_TYPES], nres[MAX_TYPES];
+  double *pres[MAX_TYPES];
+  SEXP matches, res;
+  PROTECT(matches = allocVector(VECSXP, ntype));
+  PROTECT(res = allocVector(VECSXP, ntype));
+  for (int t = 0; t < ntype; t++) {
+    SET_VECTOR_ELT(matches, t, AS_RAW(VECTOR_ELT(match, t)));
+    pmatch[t] = RAW_POINTER(VECTOR_ELT(matches, t));
+    lmatch[t] = LENGTH(VECTOR_ELT(matches, t));
+    lsequence[t] = INTEGER_POINTER(len)[t];
+    if (lmatch[t] < 1 || lmatch[t] > lsequence[t])
+      error("match[[%d]] must hold between 1 and len[%d] bytes", t + 1, t + 1);
+    if (pmatch[t][0] != pmatch[0][0])
+      error("match[[%d]] does not start with the same byte as match[[1]]", t + 1);
+    SEXP k = PROTECT(AS_RAW(VECTOR_ELT(key, t)));
+    if (LENGTH(k) != 2) error("key length must be 2");
+    check_key[t] = (((short)RAW_POINTER(k)[0]) << 8) | (short)RAW_POINTER(k)[1];
+    UNPROTECT(1);
+  }
+  // The starts are stored in buffers that grow as needed, as in
+  // locate_vector_imu_sequences(), so that memory is proportional to
+  // the number of sequences found, not to the size of the file times
+  // the number of types.
+  for (int t = 0; t < ntype; t++) {
+    nres[t] = 1024;
+    pres[t] = R_Calloc(nres[t], double);
+    next[t] = 0;
+    ires[t] = 0;
+  }
+  unsigned char lead = pmatch[0][0];
+  R_xlen_t i = 0;
+  while (i < lbuf) {
+    unsigned char *p = (unsigned char *)memchr(pbuf + i, lead, lbuf - i);
+    if (!p)
+      break;
+    i = p - pbuf;
+    for (int t = 0; t < ntype; t++) {
+      /* Types are checked independently, at the positions that
+       * locate_byte_sequences() would check, i.e. in steps of the match
+       * length, restarting at the end of each sequence found, so that the
+       * results are the same as for separate calls. */
+      if (i < next[t] || (i - next[t]) % lmatch[t] || i >= lbuf - lsequence[t])
+        continue;
+      int m;
+      for (m = 1; m < lmatch[t]; m++)
+        if (pbuf[i+m] != pmatch[t][m])
+          break;
+      if (m < lmatch[t])
+        continue;
+      short check_value = check_key[t];
+      short lsequence2 = lsequence[t] / 2;
+      if (lsequence2 > 1)
+        check_value = (short)oce_checksum_words(pbuf + i, 2 * (lsequence2 - 1), (unsigned short)check_value);
+      short check_sum = (((short)pbuf[i+lsequence[t]-1]) << 8) | (short)pbuf[i+lsequence[t]-2];
+      if (check_value == check_sum) {
+        if (ires[t] == nres[t]) {
+          nres[t] *= 2;
+          pres[t] = R_Realloc(pres[t], nres[t], double);
+        }
+        pres[t][ires[t]++] = i + 1;
+        next[t] = i + lsequence[t];
+      }
+    }
+    i++;
+  }
+  for (int t = 0; t < ntype; t++) {
+    SET_VECTOR_ELT(res, t, NEW_NUMERIC(ires[t]));
+    if (ires[t] > 0)
+      memcpy(NUMERIC_POINTER(VECTOR_ELT(res, t)), pres[t], ires[t] * sizeof(double));
+    R_Free(pres[t]);
+  }
+#undef MAX_TYPES
+  UNPROTECT(4);
+  return(res);
+}
+
 SEXP match3bytes(SEXP buf, SEXP m1, SEXP m2, SEXP m3)
 {
-  int i, j, n, n_match;
+  R_xlen_t i, j, n, n_match;
   double *resp;
   unsigned char *bufp, *m1p, *m2p, *m3p;
   SEXP res;
@@ -535,7 +648,7 @@ SEXP match3bytes(SEXP buf, SEXP m1, SEXP m2, SEXP m3)
   m1p = RAW_POINTER(m1);
   m2p = RAW_POINTER(m2);
   m3p = RAW_POINTER(m3);
-  n = LENGTH(buf);
+  n = XLENGTH(buf);
   n_match = 0;
   for (i = 0; i < n - 2; i++) {
     if (bufp[i] == *m1p && bufp[i + 1] == *m2p && bufp[i + 2] == *m3p) {
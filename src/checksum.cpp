@@ -0,0 +1,185 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// See checksum.h for an explanation of what this does, and why.
+//
+// All arithmetic is modulo 65536, so the vector kernels may let their
+// 16-bit lanes wrap around: the lane totals, added together, give the
+// same low 16 bits as a byte-by-byte (or word-by-word) sum.  Each
+// kernel handles whole vectors and then passes the leftover bytes,
+// along with its partial sum, to the scalar code.  Since vectors hold
+// an even number of bytes, the leftover words stay aligned with the
+// words of the record.
+
+#include <stddef.h>
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCE_CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#define OCE_CHECKSUM_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Records shorter than this are summed with the scalar code, since
+// they do not fill enough vectors to pay for the indirect call.
+#define SHORT_RECORD 32
+
+typedef unsigned short (*checksum_fn)(const unsigned char *p, size_t n, unsigned short seed);
+
+static unsigned short bytes_scalar(const unsigned char *p, size_t n, unsigned short seed)
+{
+  unsigned int sum = seed;
+  for (size_t i = 0; i < n; i++)
+    sum += p[i];
+  return (unsigned short)sum;
+}
+
+static unsigned short words_scalar(const unsigned char *p, size_t n, unsigned short seed)
+{
+  unsigned int sum = seed;
+  size_t i;
+  for (i = 0; i + 1 < n; i += 2)
+    sum += (unsigned int)p[i] | ((unsigned int)p[i+1] << 8);
+  if (n & 1)
+    sum += (unsigned int)p[n-1] << 8;
+  return (unsigned short)sum;
+}
+
+#ifdef OCE_CHECKSUM_X86
+__attribute__((target("sse2")))
+static unsigned short bytes_sse2(const unsigned char *p, size_t n, unsigned short seed)
+{
+  // _mm_sad_epu8() against zero adds each group of 8 bytes into a
+  // 64-bit lane, so there is no need to widen by hand.
+  __m128i zero = _mm_setzero_si128(), acc = zero;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(p + i)), zero));
+  unsigned long long lane[2];
+  _mm_storeu_si128((__m128i*)lane, acc);
+  return bytes_scalar(p + i, n - i, (unsigned short)(seed + lane[0] + lane[1]));
+}
+
+__attribute__((target("sse2")))
+static unsigned short words_sse2(const unsigned char *p, size_t n, unsigned short seed)
+{
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    acc = _mm_add_epi16(acc, _mm_loadu_si128((const __m128i*)(p + i)));
+  unsigned short lane[8];
+  _mm_storeu_si128((__m128i*)lane, acc);
+  unsigned int sum = seed;
+  for (int k = 0; k < 8; k++)
+    sum += lane[k];
+  return words_scalar(p + i, n - i, (unsigned short)sum);
+}
+
+__attribute__((target("avx2")))
+static unsigned short bytes_avx2(const unsigned char *p, size_t n, unsigned short seed)
+{
+  __m256i zero = _mm256_setzero_si256(), acc = zero;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(p + i)), zero));
+  unsigned long long lane[4];
+  _mm256_storeu_si256((__m256i*)lane, acc);
+  return bytes_scalar(p + i, n - i, (unsigned short)(seed + lane[0] + lane[1] + lane[2] + lane[3]));
+}
+
+__attribute__((target("avx2")))
+static unsigned short words_avx2(const unsigned char *p, size_t n, unsigned short seed)
+{
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    acc = _mm256_add_epi16(acc, _mm256_loadu_si256((const __m256i*)(p + i)));
+  unsigned short lane[16];
+  _mm256_storeu_si256((__m256i*)lane, acc);
+  unsigned int sum = seed;
+  for (int k = 0; k < 16; k++)
+    sum += lane[k];
+  return words_scalar(p + i, n - i, (unsigned short)sum);
+}
+#endif
+
+#ifdef OCE_CHECKSUM_NEON
+static unsigned short bytes_neon(const unsigned char *p, size_t n, unsigned short seed)
+{
+  // vpadalq_u8() adds neighbouring bytes into 16-bit lanes, which
+  // are allowed to wrap (see above).
+  uint16x8_t acc = vdupq_n_u16(0);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    acc = vpadalq_u8(acc, vld1q_u8(p + i));
+  return bytes_scalar(p + i, n - i, (unsigned short)(seed + vaddvq_u16(acc)));
+}
+
+static unsigned short words_neon(const unsigned char *p, size_t n, unsigned short seed)
+{
+  uint16x8_t acc = vdupq_n_u16(0);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    acc = vaddq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(p + i)));
+  return words_scalar(p + i, n - i, (unsigned short)(seed + vaddvq_u16(acc)));
+}
+#endif
+
+typedef struct {
+  checksum_fn bytes;
+  checksum_fn words;
+  const char *name;
+} checksum_kernel;
+
+static checksum_kernel choose_kernel()
+{
+#ifdef OCE_CHECKSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    checksum_kernel k = {bytes_avx2, words_avx2, "avx2"};
+    return k;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    checksum_kernel k = {bytes_sse2, words_sse2, "sse2"};
+    return k;
+  }
+#endif
+#ifdef OCE_CHECKSUM_NEON
+  // Advanced SIMD is a required part of 64-bit ARM, so there is
+  // nothing to ask the processor.
+  checksum_kernel neon = {bytes_neon, words_neon, "neon"};
+  return neon;
+#endif
+  checksum_kernel k = {bytes_scalar, words_scalar, "scalar"};
+  return k;
+}
+
+// C++ guarantees that a function-local static is initialised exactly
+// once, even if several threads get here at the same time.
+static const checksum_kernel& kernel()
+{
+  static const checksum_kernel k = choose_kernel();
+  return k;
+}
+
+unsigned short oce_checksum_bytes(const unsigned char *p, size_t n, unsigned short seed)
+{
+  if (n < SHORT_RECORD)
+    return bytes_scalar(p, n, seed);
+  return kernel().bytes(p, n, seed);
+}
+
+unsigned short oce_checksum_words(const unsigned char *p, size_t n, unsigned short seed)
+{
+  if (n < SHORT_RECORD)
+    return words_scalar(p, n, seed);
+  return kernel().words(p, n, seed);
+}
+
+const char *oce_checksum_kernel(void)
+{
+  return kernel().name;
+}
@@ -0,0 +1,51 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Checksums for the binary-format readers.
+//
+// The instrument formats that oce reads protect their records with one
+// of two simple checksums:
+//
+//   * a sum of bytes, modulo 65536, used by RDI ensembles (seed 0) and
+//     by SonTek ADP and ADV records (seed 0xA596), and
+//   * a sum of little-endian 16-bit words, modulo 65536, used by
+//     Nortek instruments (seed 0xB58C). If the number of bytes is odd,
+//     the last byte is added as the upper half of a final word, as in
+//     the Nortek "Integrators Guide" for the AD2CP.
+//
+// These sums dominate the time spent locating records in large files,
+// so each is done with SIMD instructions where the processor has them
+// (SSE2 or AVX2 on x86, NEON on 64-bit ARM), with a plain C loop as a
+// fallback. The choice is made once, at the first call, by asking the
+// processor which instructions it supports, so a binary built for a
+// generic x86 target still uses AVX2 on a machine that has it.
+//
+// Like mapped_file.h, this file does not include any R headers. The
+// functions have C linkage, so that they can be called from C code
+// such as bitwise.c, and they are safe to call from several threads.
+
+#ifndef OCE_CHECKSUM_H
+#define OCE_CHECKSUM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Add the 'n' bytes starting at 'p' to 'seed', modulo 65536.
+unsigned short oce_checksum_bytes(const unsigned char *p, size_t n, unsigned short seed);
+
+// Add the 'n' bytes starting at 'p', taken as little-endian 16-bit
+// words, to 'seed', modulo 65536. An odd trailing byte is added as
+// the upper half of a word.
+unsigned short oce_checksum_words(const unsigned char *p, size_t n, unsigned short seed);
+
+// Name of the kernel in use ("avx2", "sse2", "neon" or "scalar"), for
+// debugging output.
+const char *oce_checksum_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
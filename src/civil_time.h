@@ -0,0 +1,74 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Calendar arithmetic for the binary-format readers.
+//
+// Instrument files record times as calendar components (year, month,
+// day, hour, minute, second), sometimes in binary-coded decimal, and
+// sometimes as a Julian day with a time of day. Converting those to
+// seconds since 1970-01-01 UTC with ISOdatetime() costs a string
+// formatting and parsing step for each record, and the old RDI code
+// looped over the years since 1970 for each ensemble. The functions
+// here do the conversion in constant time, with the days_from_civil()
+// algorithm of Howard Hinnant, which is exact for the proleptic
+// Gregorian calendar over any range of years that fits in an int.
+// See http://howardhinnant.github.io/date_algorithms.html
+//
+// Like mapped_file.h, this file does not include any R headers. Invalid
+// inputs are reported as NaN, which R sees as NA.
+
+#ifndef OCE_CIVIL_TIME_H
+#define OCE_CIVIL_TIME_H
+
+#include <math.h>
+
+// Days from 1970-01-01 to the given date, for month in 1 to 12 and day
+// in 1 to 31 (later days roll into the next month).
+static inline long long oce_days_from_civil(long long y, int m, int d)
+{
+  y -= m <= 2;
+  long long era = (y >= 0 ? y : y - 399) / 400;
+  long long yoe = y - era * 400;                               // [0, 399]
+  long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1; // [0, 365]
+  long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;       // [0, 146096]
+  return era * 146097 + doe - 719468;
+}
+
+static inline int oce_is_leap(long long y)
+{
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+static inline int oce_days_in_month(long long y, int m)
+{
+  static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  return days[m - 1] + (m == 2 && oce_is_leap(y));
+}
+
+// Decode a binary-coded decimal byte, as in bcdToInteger().
+static inline int oce_bcd(unsigned char b)
+{
+  return 10 * (b >> 4) + (b & 0x0f);
+}
+
+// Seconds since 1970-01-01 UTC, or NaN if any component is NaN or out
+// of range, or if one that should be a whole number is not. The checks
+// follow ISOdatetime(): years must lie in 0 to 9999, and seconds may
+// be as large as 61.999..., to allow for leap seconds (a value of 60 or
+// more rolls into the next minute).
+static inline double oce_civil_to_seconds(double year, double month, double day,
+    double hour, double minute, double second)
+{
+  if (!(year >= 0 && year <= 9999 && month >= 1 && month <= 12 && day >= 1
+        && hour >= 0 && hour <= 23 && minute >= 0 && minute <= 59
+        && second >= 0 && second < 62))
+    return NAN;
+  if (year != floor(year) || month != floor(month) || day != floor(day)
+      || hour != floor(hour) || minute != floor(minute))
+    return NAN;
+  if (day > oce_days_in_month((long long)year, (int)month))
+    return NAN;
+  long long days = oce_days_from_civil((long long)year, (int)month, (int)day);
+  return 86400.0 * days + 3600.0 * hour + 60.0 * minute + second;
+}
+
+#endif
@@ -0,0 +1,254 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// See compact_array.h for an explanation of what this does, and why.
+//
+// The ALTREP vector has two data slots.  The first is a raw vector
+// holding the 16-bit values (in the byte order of the machine, since
+// they are never written out as such), or NULL once the values have
+// been expanded.  The second is a list holding the scale factors, the
+// sentinel, and the expanded values (NULL until they are needed).
+// The single-precision vectors are simpler: the first slot holds the
+// float values, and the second the expanded values. Saving either
+// kind of vector with save() or saveRDS() writes it as an ordinary
+// numeric vector.
+
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+#include <R_ext/Rdynload.h>
+#include <math.h>
+#include <string.h>
+#include "compact_array.h"
+
+#define SCALE 0
+#define SENTINEL 1
+#define EXPANDED 2
+
+static R_altrep_class_t scaled_int16_class;
+
+static SEXP expanded(SEXP x)
+{
+  return VECTOR_ELT(R_altrep_data2(x), EXPANDED);
+}
+
+static R_xlen_t scaled_int16_length(SEXP x)
+{
+  SEXP e = expanded(x);
+  return e == R_NilValue ? XLENGTH(R_altrep_data1(x)) / 2 : XLENGTH(e);
+}
+
+// Compute elements i to i+n-1, which must not have been expanded.
+static void scaled_int16_fill(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+  if (n <= 0)
+    return;
+  SEXP state = R_altrep_data2(x);
+  const short *values = (const short *)RAW(R_altrep_data1(x));
+  const double *scale = REAL(VECTOR_ELT(state, SCALE));
+  R_xlen_t np = XLENGTH(VECTOR_ELT(state, SCALE));
+  int sentinel = INTEGER(VECTOR_ELT(state, SENTINEL))[0];
+  R_xlen_t ip = i % np;
+  for (R_xlen_t k = 0; k < n; k++) {
+    short s = values[i + k];
+    double f = scale[ip];
+    buf[k] = (s == sentinel || ISNAN(f)) ? NA_REAL : f * s;
+    if (++ip == np)
+      ip = 0;
+  }
+}
+
+static Rboolean scaled_int16_inspect(SEXP x, int pre, int deep, int pvec,
+    void (*inspect_subtree)(SEXP, int, int, int))
+{
+  Rprintf(" oce scaled int16 (%s)\n", expanded(x) == R_NilValue ? "compact" : "expanded");
+  return TRUE;
+}
+
+static double scaled_int16_elt(SEXP x, R_xlen_t i)
+{
+  SEXP e = expanded(x);
+  if (e != R_NilValue)
+    return REAL(e)[i];
+  double value;
+  scaled_int16_fill(x, i, 1, &value);
+  return value;
+}
+
+static R_xlen_t scaled_int16_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+  R_xlen_t len = scaled_int16_length(x);
+  if (i + n > len)
+    n = len - i;
+  if (n <= 0)
+    return 0;
+  SEXP e = expanded(x);
+  if (e != R_NilValue)
+    memcpy(buf, REAL(e) + i, n * sizeof(double));
+  else
+    scaled_int16_fill(x, i, n, buf);
+  return n;
+}
+
+// A pointer to the data is needed, so expand the values once, and
+// discard the compact form.
+static void *scaled_int16_dataptr(SEXP x, Rboolean writeable)
+{
+  SEXP e = expanded(x);
+  if (e == R_NilValue) {
+    R_xlen_t n = scaled_int16_length(x);
+    PROTECT(e = Rf_allocVector(REALSXP, n));
+    scaled_int16_fill(x, 0, n, REAL(e));
+    SET_VECTOR_ELT(R_altrep_data2(x), EXPANDED, e);
+    R_set_altrep_data1(x, R_NilValue);
+    UNPROTECT(1);
+  }
+  return REAL(e);
+}
+
+static const void *scaled_int16_dataptr_or_null(SEXP x)
+{
+  SEXP e = expanded(x);
+  return e == R_NilValue ? NULL : REAL(e);
+}
+
+// A copy of a compact vector shares the 16-bit values and the scale
+// factors, which are never modified. Once expanded, a vector is copied
+// in the usual way.
+static SEXP scaled_int16_duplicate(SEXP x, Rboolean deep)
+{
+  if (expanded(x) != R_NilValue)
+    return NULL;
+  SEXP state = R_altrep_data2(x);
+  SEXP copy = PROTECT(Rf_allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(copy, SCALE, VECTOR_ELT(state, SCALE));
+  SET_VECTOR_ELT(copy, SENTINEL, VECTOR_ELT(state, SENTINEL));
+  SEXP res = R_new_altrep(scaled_int16_class, R_altrep_data1(x), copy);
+  UNPROTECT(1);
+  return res;
+}
+
+SEXP oce_scaled_int16(R_xlen_t n, R_xlen_t np, int sentinel, short **values, double **scale)
+{
+  SEXP data = PROTECT(Rf_allocVector(RAWSXP, 2 * n));
+  memset(RAW(data), 0, 2 * n);
+  SEXP state = PROTECT(Rf_allocVector(VECSXP, 3));
+  SEXP s = Rf_allocVector(REALSXP, np);
+  SET_VECTOR_ELT(state, SCALE, s);
+  for (R_xlen_t i = 0; i < np; i++)
+    REAL(s)[i] = NA_REAL;
+  SET_VECTOR_ELT(state, SENTINEL, Rf_ScalarInteger(sentinel));
+  *values = (short *)RAW(data);
+  *scale = REAL(s);
+  SEXP res = R_new_altrep(scaled_int16_class, data, state);
+  UNPROTECT(2);
+  return res;
+}
+
+static R_altrep_class_t float32_class;
+
+static R_xlen_t float32_length(SEXP x)
+{
+  SEXP e = R_altrep_data2(x);
+  return e == R_NilValue ? XLENGTH(R_altrep_data1(x)) / sizeof(float) : XLENGTH(e);
+}
+
+static void float32_fill(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+  const float *values = (const float *)RAW(R_altrep_data1(x)) + i;
+  for (R_xlen_t k = 0; k < n; k++)
+    buf[k] = ISNAN(values[k]) ? NA_REAL : (double)values[k];
+}
+
+static Rboolean float32_inspect(SEXP x, int pre, int deep, int pvec,
+    void (*inspect_subtree)(SEXP, int, int, int))
+{
+  Rprintf(" oce float32 (%s)\n", R_altrep_data2(x) == R_NilValue ? "compact" : "expanded");
+  return TRUE;
+}
+
+static double float32_elt(SEXP x, R_xlen_t i)
+{
+  SEXP e = R_altrep_data2(x);
+  if (e != R_NilValue)
+    return REAL(e)[i];
+  double value;
+  float32_fill(x, i, 1, &value);
+  return value;
+}
+
+static R_xlen_t float32_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf)
+{
+  R_xlen_t len = float32_length(x);
+  if (i + n > len)
+    n = len - i;
+  if (n <= 0)
+    return 0;
+  SEXP e = R_altrep_data2(x);
+  if (e != R_NilValue)
+    memcpy(buf, REAL(e) + i, n * sizeof(double));
+  else
+    float32_fill(x, i, n, buf);
+  return n;
+}
+
+static void *float32_dataptr(SEXP x, Rboolean writeable)
+{
+  SEXP e = R_altrep_data2(x);
+  if (e == R_NilValue) {
+    R_xlen_t n = float32_length(x);
+    PROTECT(e = Rf_allocVector(REALSXP, n));
+    float32_fill(x, 0, n, REAL(e));
+    R_set_altrep_data2(x, e);
+    R_set_altrep_data1(x, R_NilValue);
+    UNPROTECT(1);
+  }
+  return REAL(e);
+}
+
+static const void *float32_dataptr_or_null(SEXP x)
+{
+  SEXP e = R_altrep_data2(x);
+  return e == R_NilValue ? NULL : REAL(e);
+}
+
+static SEXP float32_duplicate(SEXP x, Rboolean deep)
+{
+  if (R_altrep_data2(x) != R_NilValue)
+    return NULL;
+  return R_new_altrep(float32_class, R_altrep_data1(x), R_NilValue);
+}
+
+SEXP oce_float32(R_xlen_t n, float **values)
+{
+  SEXP data = PROTECT(Rf_allocVector(RAWSXP, n * sizeof(float)));
+  float *f = (float *)RAW(data);
+  for (R_xlen_t i = 0; i < n; i++)
+    f[i] = NAN;
+  *values = f;
+  SEXP res = R_new_altrep(float32_class, data, R_NilValue);
+  UNPROTECT(1);
+  return res;
+}
+
+// Called by R_init_oce(), in registerDynamicSymbol.c.
+extern "C" void oce_init_altrep(DllInfo *dll)
+{
+  R_altrep_class_t cls = R_make_altreal_class("scaled_int16", "oce", dll);
+  R_set_altrep_Length_method(cls, scaled_int16_length);
+  R_set_altrep_Inspect_method(cls, scaled_int16_inspect);
+  R_set_altrep_Duplicate_method(cls, scaled_int16_duplicate);
+  R_set_altvec_Dataptr_method(cls, scaled_int16_dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, scaled_int16_dataptr_or_null);
+  R_set_altreal_Elt_method(cls, scaled_int16_elt);
+  R_set_altreal_Get_region_method(cls, scaled_int16_get_region);
+  scaled_int16_class = cls;
+  cls = R_make_altreal_class("float32", "oce", dll);
+  R_set_altrep_Length_method(cls, float32_length);
+  R_set_altrep_Inspect_method(cls, float32_inspect);
+  R_set_altrep_Duplicate_method(cls, float32_duplicate);
+  R_set_altvec_Dataptr_method(cls, float32_dataptr);
+  R_set_altvec_Dataptr_or_null_method(cls, float32_dataptr_or_null);
+  R_set_altreal_Elt_method(cls, float32_elt);
+  R_set_altreal_Get_region_method(cls, float32_get_region);
+  float32_class = cls;
+}
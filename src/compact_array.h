@@ -0,0 +1,49 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Compact storage for scaled 16-bit data, and for single-precision
+// data.
+//
+// Instruments store velocities as 16-bit integers, which are scaled to
+// m/s by a factor that may differ from one record (profile) to the
+// next. Expanding them to doubles quadruples the memory they occupy,
+// which matters for multi-GB files. oce_scaled_int16() creates a
+// double vector, for use in R, that holds the 16-bit values and one
+// scale factor per record, and computes each double value as it is
+// needed. It is an ALTREP vector, so that R code (e.g. the [[ and
+// plot methods) sees an ordinary numeric vector. If R code needs a
+// pointer to the data, e.g. to modify an element or to pass the vector
+// to C++ code, the values are expanded to doubles once, and the 16-bit
+// values are discarded.
+//
+// The vector is indexed as an R array with the record varying
+// fastest, e.g. [record, cell, beam], so element i belongs to record
+// i % np. Its value is NA if the record's scale factor is NA (which is
+// how the scale starts out), or if the 16-bit value equals 'sentinel'
+// (use OCE_NO_SENTINEL if no value means NA); otherwise it is the
+// scale factor times the 16-bit value.
+//
+// The storage must be filled, through the 'values' and 'scale'
+// pointers, before the vector is used in R. This may be done from
+// several threads, since the pointers are plain C arrays.
+
+#ifndef OCE_COMPACT_ARRAY_H
+#define OCE_COMPACT_ARRAY_H
+
+#include <Rinternals.h>
+
+#define OCE_NO_SENTINEL 0x10000 // outside the range of a 16-bit value
+
+// Create a vector of length n, for records numbering np (which must
+// divide n), and set 'values' to point to its n 16-bit values (all 0)
+// and 'scale' to its np scale factors (all NA). The result is not
+// protected.
+SEXP oce_scaled_int16(R_xlen_t n, R_xlen_t np, int sentinel, short **values, double **scale);
+
+// Create a vector of length n, held as single-precision values, and
+// set 'values' to point to them (all NaN, which R sees as NA). This
+// suits data, such as the complex samples of Nortek echosounderRaw
+// records, whose precision does not warrant doubles. The result is
+// not protected.
+SEXP oce_float32(R_xlen_t n, float **values);
+
+#endif
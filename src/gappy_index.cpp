@@ -1,5 +1,6 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
 
+#include <climits>
 #include <Rcpp.h>
 using namespace Rcpp;
 
@@ -7,33 +8,46 @@ using namespace Rcpp;
 // 1. update ../src/registerDynamicSymbol.c with an item for this
 // 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
 //
+// 'starts' is numeric, so that it can hold offsets into files larger
+// than 2 GiB. The result is an integer vector if all of its values fit
+// in an int, which is the usual case, since that takes half the memory
+// of a numeric vector; otherwise, it is a numeric vector.
+//
 // [[Rcpp::export]]
-IntegerVector do_gappy_index(IntegerVector starts, IntegerVector offset, IntegerVector length)
+SEXP do_gappy_index(NumericVector starts, IntegerVector offset, IntegerVector length)
 {
-    long int nstarts = starts.size();
-    long int n = nstarts * length[0];
-    long int k = 0;
-    IntegerVector res(n);
+    R_xlen_t nstarts = starts.size();
+    R_xlen_t n = nstarts * length[0];
     if (nstarts > 0) {
-      long int minspan = 100 * nstarts * length[0]; // start large
-      for (long int i = 1; i < nstarts; i++) {
-        long int span = starts[i] - starts[i-1];
+      double minspan = 100.0 * nstarts * length[0]; // start large
+      for (R_xlen_t i = 1; i < nstarts; i++) {
+        double span = starts[i] - starts[i-1];
         if (span < minspan)
           minspan = span;
       }
       if (length[0] > minspan)
-        ::Rf_error("'length' %d exceeds minimum span between 'starts' elements (%d)", length[0], minspan);
+        ::Rf_error("'length' %d exceeds minimum span between 'starts' elements (%.0f)", length[0], minspan);
     }
-    for (long int i = 0; i < nstarts; i++) {
-      long int off = offset[0];
-      for (long int j = 0; j < length[0]; j++) {
-        res[k++] = starts[i] + off;
-        off++;
-        if (k > n) {
-          break;
-        }
+    double max = 0.0;
+    for (R_xlen_t i = 0; i < nstarts; i++)
+      if (starts[i] > max)
+        max = starts[i];
+    if (max + offset[0] + length[0] - 1 <= INT_MAX) {
+      IntegerVector res(n);
+      R_xlen_t k = 0;
+      for (R_xlen_t i = 0; i < nstarts; i++) {
+        int off = (int)starts[i] + offset[0];
+        for (int j = 0; j < length[0]; j++)
+          res[k++] = off + j;
       }
+      return res;
+    }
+    NumericVector res(n);
+    R_xlen_t k = 0;
+    for (R_xlen_t i = 0; i < nstarts; i++) {
+      double off = starts[i] + offset[0];
+      for (int j = 0; j < length[0]; j++)
+        res[k++] = off + j;
     }
     return res;
 }
-
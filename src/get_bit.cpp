@@ -1,6 +1,7 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
 
 #include <Rcpp.h>
+#include "checksum.h"
 using namespace Rcpp;
 
 // Cross-reference work:
@@ -22,3 +23,29 @@ NumericVector do_get_bit(RawVector buf, int bit) // bit=0 for rightmost bit, =7
   }
   return(res);
 }
+
+// Checksums of the 'n' bytes starting at each of the 0-based offsets
+// 'start' within 'buf', as computed by the binary-format readers (see
+// checksum.h): a sum of bytes if 'words' is 0, or of little-endian
+// 16-bit words otherwise, added to 'seed', modulo 65536. This lets the
+// tests check the SIMD kernels against a sum done in R. The name of
+// the kernel in use is returned as the "kernel" attribute.
+//
+// [[Rcpp::export]]
+IntegerVector do_checksum(RawVector buf, NumericVector start, int n, int seed, int words)
+{
+  R_xlen_t nstart = start.size(), nbuf = buf.size();
+  if (n < 0)
+    ::Rf_error("n must be non-negative, but it is %d", n);
+  IntegerVector res(nstart);
+  const unsigned char *b = &buf[0];
+  for (R_xlen_t i = 0; i < nstart; i++) {
+    if (ISNAN(start[i]) || start[i] < 0 || start[i] + n > nbuf)
+      ::Rf_error("start[%lld]=%g is outside the buffer, for n=%d", (long long)(i + 1), start[i], n);
+    const unsigned char *p = b + (R_xlen_t)start[i];
+    res[i] = words ? oce_checksum_words(p, n, (unsigned short)seed)
+      : oce_checksum_bytes(p, n, (unsigned short)seed);
+  }
+  res.attr("kernel") = oce_checksum_kernel();
+  return(res);
+}
@@ -1,6 +1,12 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=100: */
 
+#include <limits.h>
+#include <string.h>
 #include <Rcpp.h>
+#include "ad2cp_index.h"
+#include "checksum.h"
+#include "civil_time.h"
+#include "mapped_file.h"
 using namespace Rcpp;
 
 // Cross-reference work:
@@ -20,10 +26,10 @@ using namespace Rcpp;
 //#define HEADER_SIZE 10 // but can't this be 12 sometimes? (See below.)
 #define FAMILY 0x10
 
-// allowed: 0x15-0x18, ox1a-0x1f, 0x23, 0xa0
-// allowed: 21-24, 26-31, 35, 160
-#define NID_ALLOWED 12
-int ID_ALLOWED[NID_ALLOWED]={21, 22, 23, 24, 26, 27, 28, 29, 30, 31, 35, 160};
+// allowed: 0x15-0x18, ox1a-0x1f, 0x23, 0x24, 0xa0
+// allowed: 21-24, 26-31, 35, 36, 160
+#define NID_ALLOWED 13
+int ID_ALLOWED[NID_ALLOWED]={21, 22, 23, 24, 26, 27, 28, 29, 30, 31, 35, 36, 160};
 
 /*
 
@@ -31,27 +37,56 @@ int ID_ALLOWED[NID_ALLOWED]={21, 22, 23, 24, 26, 27, 28, 29, 30, 31, 35, 160};
 
    @param filename character string indicating the file name.
 
-   @param from integer giving the index of the first ensemble (AKA
-   profile) to retrieve. The R notation is used, i.e. from=1 means the
-   first profile.
-
-   @param to integer giving the index of the last ensemble to retrieve.
-   As a special case, setting this to 0 will retrieve *all* the data
-   within the file.
-
-   @param by integer giving increment of the sequence, as for seq(), i.e.
-   a value of 1 means to retrieve all the profiles, while a value of 2
-   means to get every second profile.
-
-   @value a list containing 'index', 'length' and 'id'. The last of
-   these indicates the type of data record (see the table below).
+   @param id integer vector holding the IDs of the wanted record types
+   (see the table below), or an empty vector to get all of them. Other
+   records are stepped over, but not returned.
+
+   @param skipUnwanted integer; if nonzero, the data checksums of records
+   that are not returned are not computed. Their header checksums are
+   still checked, so a damaged header is noticed, but a damaged data
+   record is not. This saves reading the data of the unwanted records,
+   which may be most of the file.
+
+   @param indexFile character string naming an index file (see
+   ad2cp_index.h), or "" to avoid the use of an index. If the index
+   matches the data file, the records are selected from it, and the
+   file is not scanned. Otherwise, the whole file is scanned, with all
+   checksums computed (regardless of 'skipUnwanted'), and the index is
+   written for use in later calls.
+
+   @value a list containing 'start', 'index', 'headerLength',
+   'dataLength', 'id' and 'time', for the returned records only. The
+   'id' indicates the type of data record (see the table below), and
+   'time' is NA for string records. Since version 1.8-2, 'start' and
+   'index' are numeric (double) vectors, not integer vectors, so that
+   they can hold offsets in files larger than 2 GiB.
 
    @examples
 
    system("R CMD SHLIB ldc_ad2cp_in_file.c")
    f <- "/Users/kelley/Dropbox/oce_ad2cp/labtestsig3.ad2cp"
    dyn.load("ldc_ad2cp_in_file.so")
-   a <- .Call("ldc_ad2cp_in_file", f, 1, 10, 1)
+   a <- .Call("ldc_ad2cp_in_file", f, integer(), 0, "", 0)
+   # average records, and configuration strings, only
+   a <- .Call("ldc_ad2cp_in_file", f, c(0x16, 0xa0), 1, "", 0)
+
+@section history:
+
+Until version 1.8-2, the file was read with fread(), with an fseek()
+to give back 2 bytes after each 10-byte header, and each record was
+copied into a buffer to compute its checksum. Then, after a data
+checksum failure, the file was searched for the next header one
+getc() at a time. Now the file is memory-mapped (see mapped_file.h),
+headers are parsed where they lie, checksums are computed with SIMD
+instructions (see checksum.h), and the search for the next header
+uses memchr(). The returned values are unchanged, except that data
+records longer than 65535 bytes (which need 12-byte headers) are now
+checksummed in full, instead of being checked against a sum over the
+low 16 bits of their length, which gave false checksum failures.
+
+Also in version 1.8-2, the 'from', 'to' and 'by' arguments were
+removed, since read.adp.ad2cp() always asked for all the records, and
+then selected from those of the chosen data type, plan and data set.
 
 @section: notes
 
@@ -127,136 +162,265 @@ Dan Kelley
 // comments along the lines of "will this ever happen?".  See also
 // https://github.com/aodn/imos-toolbox/blob/master/Parser/readAD2CPBinary.m for
 // some Matlab code.
-unsigned short cs(unsigned char *data, unsigned short size, int debug)
+unsigned short cs(const unsigned char *data, size_t size, int debug)
 {
   unsigned short checksum = 0xB58C;
-  if (debug > 1) {
-    Rprintf("    %d data: 0x%02x 0x%02x 0x%02x 0x%02x ... 0x%02x 0x%02x 0x%02x 0x%02x\n",
-        size, data[0], data[1], data[2], data[3],
+  if (debug > 1 && size >= 4) {
+    Rprintf("    %lld data: 0x%02x 0x%02x 0x%02x 0x%02x ... 0x%02x 0x%02x 0x%02x 0x%02x\n",
+        (long long)size, data[0], data[1], data[2], data[3],
         data[size-4], data[size-3], data[size-2], data[size-1]);
   }
-  for (int i = 0; i < size-1; i += 2) {
-    unsigned short upper = data[i+1] << 8;
-    unsigned short lower = data[i];
-    unsigned short sum = (upper + lower ) & 0xffff;
-    checksum = (checksum + sum) & 0xffff;
+  // The odd-size case, in which the last byte is taken as the upper
+  // half of a word, is handled by oce_checksum_words().
+  checksum = oce_checksum_words(data, size, checksum);
+  if (debug > 1 && 1 == size%2) {
+    Rprintf("    odd # data, cs is 0x%x\n", checksum);
   }
-  // Handle the case of size being an odd number
-  if (1 == size%2) {
-    if (debug > 1) {
-      Rprintf("    odd # data, so cs changed from 0x%x ", checksum);
+  return(checksum);
+}
+
+// Bytes searched for a SYNC character in each call to span(), which
+// bounds the window in the unmapped case.
+#define SEARCH_CHUNK 4194304
+
+// Find the first SYNC byte at or after 'pos', returning its offset, or
+// -1 if there is none. This uses memchr(), which is vectorised in the
+// common C libraries.
+static long long ad2cp_find_sync(MappedFile& mf, long long pos)
+{
+  long long size = mf.size();
+  while (pos < size) {
+    long long n = mf.run(pos);
+    if (n > SEARCH_CHUNK)
+      n = SEARCH_CHUNK;
+    const unsigned char *p = mf.span(pos, n);
+    if (!p)
+      return -1;
+    const unsigned char *q = (const unsigned char *)memchr(p, SYNC, (size_t)n);
+    if (q)
+      return pos + (q - p);
+    pos += n;
+  }
+  return -1;
+}
+
+// After a data checksum failure, look for the next header, starting at
+// 'pos'. A candidate is a SYNC byte that is followed by a header size
+// of 10 or 12, any id byte, and the family of the damaged record. The
+// bytes of a rejected candidate are not searched again, as in the
+// getc() loop used before version 1.8-2. Returns the offset of the
+// header, or -1 if the end of the file is reached first.
+static long long ad2cp_resync(MappedFile& mf, long long pos, unsigned char family, double filesize)
+{
+  while (1) {
+    long long s = ad2cp_find_sync(mf, pos);
+    if (s < 0) {
+      Rprintf("... got to end of file while searching for a sync character (0x%02x)\n", SYNC);
+      return -1;
     }
-    checksum += ((unsigned short)(data[size-1] << 8)) & 0xffff;
-    if (debug > 1) {
-      Rprintf("to 0x%x\n", checksum);
+    Rprintf("... got a sync character (0x%02x) at cindex=%lld (%7.4f%% through file)\n",
+        SYNC, s + 1, 100.0*(s + 1)/filesize);
+    int trial_header_size = mf.byte(s + 1);
+    if (trial_header_size == EOF) {
+      Rprintf("    got to end of file while searching for a header-size character at cindex=%lld\n", s + 2);
+      return -1;
+    }
+    if (trial_header_size != 10 && trial_header_size != 12) {
+      Rprintf("    header-size is %d, not 10 or 12 as expected\n", trial_header_size);
+      pos = s + 2;
+      continue;
     }
+    // Skip over the id byte, which has many possibilities we know of (and perhaps more),
+    // so it is a bit hard to check for correctness.
+    if (mf.byte(s + 2) == EOF) {
+      Rprintf("got to end of file while searching for an 'id' byte\n");
+      return -1;
+    }
+    // family: assume it's the same for the whole file.
+    int c = mf.byte(s + 3);
+    if (c == EOF) {
+      Rprintf("got to end of file while searching for a the 'family' byte\n");
+      return -1;
+    }
+    if (c == family) {
+      Rprintf("   ... skipped forward to a possible header at cindex=%lld\n", s);
+      return s;
+    }
+    Rprintf(" expecting family (0x%02x) but got 0x%02x at cindex=%lld\n", family, c, s + 4);
+    pos = s + 4;
   }
-  return(checksum);
 }
 
-//List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerVector to, IntegerVector by, IntegerVector ignoreChecksums, IntegerVector DEBUG)
+// The time of a record, in seconds since 1970-01-01 UTC, or NaN for
+// string records, and for records too short to hold a time.  The time
+// is at offset 8 of most records [1 table 6.2 page 81], but at offset
+// 2 of echosounderRaw records, with 1/100 s in place of 1e-4 s.
+static double ad2cp_record_time(const unsigned char *p, unsigned long n, int id)
+{
+  if (id == 0x23 || id == 0x24) {
+    if (n < 9)
+      return NAN;
+    return oce_civil_to_seconds(1900 + p[2], 1 + p[3], p[4], p[5], p[6], p[7] + 0.01 * p[8]);
+  }
+  if (id == 0xa0 || n < 16)
+    return NAN;
+  return oce_civil_to_seconds(1900 + p[8], 1 + p[9], p[10], p[11], p[12],
+      p[13] + 1e-4 * (p[14] + 256 * p[15]));
+}
+
+// Copy the records of the wanted types from an index to the locator's
+// buffers.
+static long long ad2cp_select(const ad2cp_index& ix, const unsigned char *wanted,
+    long long *start_buf, long long *index_buf, unsigned int *header_length_buf,
+    unsigned int *data_length_buf, unsigned int *id_buf, double *time_buf)
+{
+  long long chunk = 0;
+  for (size_t i = 0; i < ix.entries.size(); i++) {
+    const ad2cp_index_entry& e = ix.entries[i];
+    if (!wanted[e.id])
+      continue;
+    start_buf[chunk] = e.start;
+    index_buf[chunk] = e.index;
+    header_length_buf[chunk] = e.header_length;
+    data_length_buf[chunk] = e.data_length;
+    id_buf[chunk] = e.id;
+    time_buf[chunk] = e.time;
+    chunk++;
+  }
+  return chunk;
+}
 
 // [[Rcpp::export]]
-List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerVector to, IntegerVector by, IntegerVector DEBUG)
+List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector id, IntegerVector skipUnwanted,
+    StringVector indexFile, IntegerVector DEBUG)
 {
   int debug = DEBUG[0] < 0 ? 0 : DEBUG[0];
   std::string fn = Rcpp::as<std::string>(filename(0));
-  FILE *fp = fopen(fn.c_str(), "rb");
-  if (!fp)
+  std::string index_name = Rcpp::as<std::string>(indexFile(0));
+  int skip_unwanted = skipUnwanted[0] != 0;
+  // Wanted record types.
+  unsigned char wanted[256];
+  memset(wanted, id.size() ? 0 : 1, sizeof(wanted));
+  for (R_xlen_t i = 0; i < id.size(); i++) {
+    if (id[i] < 0 || id[i] > 255)
+      ::Rf_error("'id' values must be between 0 and 255, but one is %d", id[i]);
+    wanted[id[i]] = 1;
+  }
+  MappedFile mf;
+  if (mf.open(fn.c_str()))
     ::Rf_error("cannot open file '%s'\n", fn.c_str());
-  if (from[0] < 0)
-    ::Rf_error("'from' must be positive but it is %d", from[0]);
-  //unsigned int from_value = from[0];
-  if (to[0] < 0)
-    ::Rf_error("'to' must be positive but it is %d", to[0]);
-  unsigned int to_value = to[0];
-  if (by[0] < 0)
-    ::Rf_error("'by' must be positive but it is %d", by[0]);
-  //unsigned int by_value = by[0];
-
-  // Find file size, and return to start
-  fseek(fp, 0L, SEEK_END);
-  long long int filesize = ftell(fp);
-  fseek(fp, 0L, SEEK_SET);
+  long long int filesize = mf.size();
   if (debug) {
-    Rprintf("do_ldc_ad2cp_in_file(filename, from=%d, to=%d, by=%d, debug=%d) {\n", from[0], to[0], by[0], DEBUG[0]);
+    Rprintf("do_ldc_ad2cp_in_file(filename, id, skipUnwanted=%d, debug=%d) {\n",
+        skip_unwanted, DEBUG[0]);
     Rprintf("  filename=\"%s\"\n", fn.c_str());
-    //Rprintf("  ignoreChecksums[0]=%d\n", ignoreChecksums[0]);
-    Rprintf("  filesize=%d bytes\n", filesize);
+    Rprintf("  filesize=%lld bytes (%s)\n", filesize, mf.mapped() ? "memory-mapped" : "read through a buffer");
+    if (id.size()) {
+      Rprintf("  wanted IDs:");
+      for (R_xlen_t i = 0; i < id.size(); i++)
+        Rprintf(" 0x%02x", id[i]);
+      Rprintf("\n");
+    }
+  }
+  // If there is a valid index, we select from it instead of scanning
+  // the file. Otherwise, if an index was requested, we scan the whole
+  // file, keeping every record, and select from that afterwards.
+  ad2cp_index ix;
+  int use_index = 0, build_index = 0;
+  if (index_name.size()) {
+    if (0 == ad2cp_index_read(index_name.c_str(), fn.c_str(), ix)) {
+      use_index = 1;
+      if (debug)
+        Rprintf("  using %d-record index file '%s'\n", (int)ix.entries.size(), index_name.c_str());
+    } else {
+      build_index = 1;
+      if (debug)
+        Rprintf("  will create index file '%s'\n", index_name.c_str());
+    }
+  }
+  unsigned char scan_wanted[256];
+  memcpy(scan_wanted, wanted, sizeof(wanted));
+  if (build_index) {
+    memset(scan_wanted, 1, sizeof(scan_wanted));
+    skip_unwanted = 0;
   }
-  long long int chunk = 0;
-  long long int cindex = 0;//, cindex_last_good = 0;
+  long long int chunk = 0;             // number of records returned
+  long long int record = 0;            // number of records examined
   int checksum_failures = 0;
+  long long failure_buf[128];          // where checksum failures occurred
 
   // Ensure that the first byte we point to equals SYNC.  In a
-  // conventional file, starting with a SYNC char, this just gets a
-  // byte and puts it back, leaving cindex=0.  But if the file does
-  // not start with a SYNC char, e.g.  if the file is a fragment of a
-  // larger file, we first step through the file until we find a SYNC,
-  // setting cindex appropriately.
-  int c;
-  while (1) {
-    c = getc(fp);
-    if (c == EOF) {
-      ::Rf_error("this file does not contain a single 0x", SYNC, " byte");
-      break;
-    }
-    if (SYNC == c) {
-      fseek(fp, -1, SEEK_CUR);
-      break;
-    }
-    cindex++;
+  // conventional file, starting with a SYNC char, this leaves
+  // cindex=0.  But if the file does not start with a SYNC char, e.g.
+  // if the file is a fragment of a larger file, we skip to the first
+  // SYNC, setting cindex appropriately.
+  long long int cindex = use_index ? 0 : ad2cp_find_sync(mf, 0);
+  if (cindex < 0) {
+    mf.close();
+    ::Rf_error("this file does not contain a single 0x%02x byte", SYNC);
   }
   if (debug)
-    Rprintf("First SYNC byte (0x%02x) at cindex=%d\n", SYNC, cindex);
+    Rprintf("First SYNC byte (0x%02x) at cindex=%lld\n", SYNC, cindex);
   // The table in [ref 1 sec 6.1, page 80-81] says header pieces are
-  // 10 bytes long, so once we get an 0xA5, we'll read 9 more
-  // bytes to assemble the header in bytes10.  (We grab all the
-  // bytes at once, so we can do a checksum.)
-  unsigned char header_bytes[12];   // to store either 10 or 12-byte headers
+  // 10 or 12 bytes long. Each header is examined where it lies in the
+  // file (see mapped_file.h), as is the data record that follows it.
   struct header {
     unsigned char sync;             // 1 byte
     unsigned char header_size;      // 1 byte
     unsigned char id;               // 1 byte
     unsigned char family;           // 1 byte; must be 0x10 for ad2cp
-    unsigned long data_size;        // 2 bytes
+    unsigned long data_size;        // 2 or 4 bytes
     unsigned short data_checksum;   // 2 bytes
     unsigned short header_checksum; // 2 bytes
   } header;
-  unsigned int dbuflen = 10000; // may be increased later
-  unsigned char *dbuf = (unsigned char *)R_Calloc((size_t)dbuflen, unsigned char);
-  unsigned int nchunk = 100000;
-  unsigned int *start_buf = (unsigned int*)R_Calloc((size_t)nchunk, unsigned int);
-  unsigned int *index_buf = (unsigned int*)R_Calloc((size_t)nchunk, unsigned int);
+  unsigned int nchunk = use_index ? (unsigned int)ix.entries.size() + 1 : 100000;
+  long long *start_buf = (long long*)R_Calloc((size_t)nchunk, long long);
+  long long *index_buf = (long long*)R_Calloc((size_t)nchunk, long long);
   unsigned int *header_length_buf = (unsigned int*)R_Calloc((size_t)nchunk, unsigned int);
   unsigned int *data_length_buf = (unsigned int*)R_Calloc((size_t)nchunk, unsigned int);
   unsigned int *id_buf = (unsigned int*)R_Calloc((size_t)nchunk, unsigned int);
+  double *time_buf = (double*)R_Calloc((size_t)nchunk, double);
+  // Free the storage, and unmap the file, before reporting an error.
+#define AD2CP_ERROR(...) do { \
+    R_Free(start_buf); R_Free(index_buf); R_Free(header_length_buf); \
+    R_Free(data_length_buf); R_Free(id_buf); R_Free(time_buf); mf.close(); \
+    ::Rf_error(__VA_ARGS__); \
+  } while (0)
   int early_EOF = 0;
-  int reset_cindex = 0; // set to 1 if we skipped to find a new header start, after a bad checksum
-  while (chunk < to_value && cindex < filesize) { // FIXME: use whole file here
+  if (use_index) {
+    early_EOF = ix.early_EOF;
+    checksum_failures = (int)ix.checksum_failures.size();
+    for (int i = 0; i < checksum_failures; i++)
+      Rprintf("ERROR: checksum failure at cindex=%lld (recorded in index file)\n",
+          ix.checksum_failures[i]);
+    chunk = ad2cp_select(ix, wanted,
+        start_buf, index_buf, header_length_buf, data_length_buf, id_buf, time_buf);
+    cindex = filesize; // skip the scan
+  }
+  while (cindex < filesize) {
     if (checksum_failures > 100)
-      ::Rf_error("more than 100 checksum errors");
+      AD2CP_ERROR("more than 100 checksum errors");
     if (chunk > nchunk - 1) {
       if (debug)
         Rprintf("  increasing 'index_buf' size from %d ... ", nchunk);
       nchunk = (unsigned int) floor(chunk * 1.4); // increase buffer size by sqrt(2)
-      start_buf = (unsigned int*)R_Realloc(start_buf, nchunk, unsigned int);
-      index_buf = (unsigned int*)R_Realloc(index_buf, nchunk, unsigned int);
+      start_buf = (long long*)R_Realloc(start_buf, nchunk, long long);
+      index_buf = (long long*)R_Realloc(index_buf, nchunk, long long);
       header_length_buf = (unsigned int*)R_Realloc(header_length_buf, nchunk, unsigned int);
       data_length_buf = (unsigned int*)R_Realloc(data_length_buf, nchunk, unsigned int);
       id_buf = (unsigned int*)R_Realloc(id_buf, nchunk, unsigned int);
+      time_buf = (double*)R_Realloc(time_buf, nchunk, double);
       if (debug)
         Rprintf(" to %d ... done\n", nchunk);
     }
-    size_t bytes_read;
-    // Return 2 of these bytes later, if the header length is 10.
-    if (12 != fread(&header_bytes, 1, 12, fp))
-      ::Rf_error("cannot read header_bytes at cindex=%ld of %ld byte file\n", cindex, filesize);
-    // if (1 != fread(&header.sync, 1, 1, fp))
-    //   ::Rf_error("cannot read header.sync at cindex=%ld of %ld byte file\n", cindex, filesize);
+    // As before version 1.8-2, require 12 bytes, even for a 10-byte
+    // header.
+    const unsigned char *header_bytes = mf.span(cindex, 12);
+    if (!header_bytes)
+      AD2CP_ERROR("cannot read header_bytes at cindex=%lld of %lld byte file\n", cindex, filesize);
     header.sync = header_bytes[0];
     if (header.sync != SYNC)
-      ::Rf_error("expected header.sync to be 0x%02x but it was 0x%02x at cindex=%ld (%7.4f%% through file) ... skipping to next 0x%02x character...\n", SYNC, header.sync, cindex, 100.0*cindex/filesize, SYNC);
+      AD2CP_ERROR("expected header.sync to be 0x%02x but it was 0x%02x at cindex=%lld (%7.4f%% through file) ... skipping to next 0x%02x character...\n", SYNC, header.sync, cindex, 100.0*cindex/filesize, SYNC);
     header.header_size = header_bytes[1];
     header.id = header_bytes[2];
     header.family = header_bytes[3];
@@ -265,19 +429,17 @@ List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerV
       header.data_size = header_bytes[4] + 256 * header_bytes[5];
       header.data_checksum = header_bytes[6] + 256 * header_bytes[7];
       header.header_checksum = header_bytes[8] + 256 * header_bytes[9];
-      // Give 2 bytes back, since we read 12 and only need 10
-      fseek(fp, -2, SEEK_CUR);
     } else if (header.header_size == 12) {
-      header.data_size = header_bytes[4] + 256 * (header_bytes[5] + 256 * (header_bytes[6] + 256 * header_bytes[7]));
+      header.data_size = header_bytes[4] + 256 * (header_bytes[5] + 256 * (header_bytes[6] + 256 * (unsigned long)header_bytes[7]));
       header.data_checksum = header_bytes[8] + 256 * header_bytes[9];
       header.header_checksum = header_bytes[10] + 256 * header_bytes[11];
     } else {
-      ::Rf_error("invalid header.header_size %d (must be 10 or 12) at cindex=%ld (%7.4f%% through file)\n",
+      AD2CP_ERROR("invalid header.header_size %d (must be 10 or 12) at cindex=%lld (%7.4f%% through file)\n",
           header.header_size, cindex, 100.0*(cindex)/filesize);
     }
     if (debug > 1) {
-      Rprintf("Chunk %d at cindex=%ld, %.5f%% through file: header_size=%d, data_size=%d, id=0x%02x=",
-          chunk, cindex, 100.0*cindex/filesize, header.header_size, header.data_size, header.id);
+      Rprintf("Chunk %lld at cindex=%lld, %.5f%% through file: header_size=%d, data_size=%lu, id=0x%02x=",
+          record, cindex, 100.0*cindex/filesize, header.header_size, header.data_size, header.id);
       if (header.id == 0xa0) Rprintf("String\n");
       else if (header.id == 0x15) Rprintf("Burst data record\n");
       else if (header.id == 0x16) Rprintf("Average data record\n");
@@ -292,36 +454,25 @@ List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerV
       else if (header.id == 0x23) Rprintf("Echo Sounder raw sample data record\n");
       else if (header.id == 0x24) Rprintf("Echo Sounder raw synthetic transmit pulse data record\n");
       else Rprintf("Unrecognized ID (0x%02x)\n", header.id);
-      Rprintf("  header_size=0x%02x=%d id=0x%02x family=0x%02x data_size=%d\n",
+      Rprintf("  header_size=0x%02x=%d id=0x%02x family=0x%02x data_size=%lu\n",
           header.header_size, header.header_size, header.id, header.family,
           header.data_size);
-      if (cindex != ftell(fp) - header.header_size)
-        Rprintf("Bug: cindex (%ld) is not equal to ftell()-header_size (%d)\n",
-            cindex, ftell(fp)-header.header_size);
     } // debug
     // See if header checksum is correct
     unsigned short computed_header_checksum;
     computed_header_checksum = cs(header_bytes, header.header_size-2, debug);
-    //if (ignoreChecksums[0] > 0 || computed_header_checksum == header.header_checksum) {
     if (computed_header_checksum == header.header_checksum) {
-      if (debug > 1) {
-        if (computed_header_checksum == header.header_checksum) {
-          Rprintf("    cindex=%ld: header checksum 0x%02x is correct\n", cindex, header.header_checksum);
-        } else {
-          Rprintf("    cindex=%ld: header checksum 0x%02x disagrees with expectation 0x%02x\n", cindex, computed_header_checksum, header.header_checksum);
-        }
-      }
+      if (debug > 1)
+        Rprintf("    cindex=%lld: header checksum 0x%02x is correct\n", cindex, header.header_checksum);
     } else {
+      if (checksum_failures < 128)
+        failure_buf[checksum_failures] = cindex;
       checksum_failures++;
-      Rprintf("ERROR: header checksum (0x%02x) disagrees with expectation (0x%02x) at cindex=%ld\n",
+      Rprintf("ERROR: header checksum (0x%02x) disagrees with expectation (0x%02x) at cindex=%lld\n",
           computed_header_checksum, header.header_checksum, cindex);
     }
-    start_buf[chunk] = cindex;
+    long long int record_start = cindex;
     cindex = cindex + header.header_size;
-    index_buf[chunk] = cindex;
-    header_length_buf[chunk] = header.header_size;
-    data_length_buf[chunk] = header.data_size;
-
     int found = 0;
     for (int idi = 0; idi < NID_ALLOWED; idi++) {
       if (header.id == ID_ALLOWED[idi]) {
@@ -330,122 +481,92 @@ List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerV
       }
     }
     if (found == 0)
-      Rf_warning("undocumented header ID 0x%02x at cindex %ld", header.id, cindex);
-    id_buf[chunk] = header.id;
-    // Check the header checksum.
-    // Increase size of data buffer, if required.
-    if (header.data_size > dbuflen) { // expand the buffer if required
-      if (debug)
-        Rprintf("Increasing 'dbuf' size from %d to %d at cindex:%ld (%.4f%%)\n",
-            dbuflen, header.data_size, cindex, 100.0*cindex/filesize);
-      if (cindex != ftell(fp))
-        Rprintf("  *BUG*: cindex=%ld is out of synch with ftell(fp)=%ld\n", cindex, ftell(fp));
-      dbuflen = header.data_size;
-      dbuf = (unsigned char *)R_Realloc(dbuf, dbuflen, unsigned char);
+      Rf_warning("undocumented header ID 0x%02x at cindex %lld", header.id, cindex);
+    // Decide whether to return this record.
+    int keep = scan_wanted[header.id];
+    record++;
+    // Check that we have all the data
+    if ((long long)header.data_size > filesize - cindex) {
+      Rf_warning("early EOF in chunk %lld at cindex=%lld",
+          record, cindex-header.header_size);
+      break; // give up
     }
-    // Read the data
-    bytes_read = fread(dbuf, 1, header.data_size, fp);
-    // Check that we got all the data
-    if (bytes_read != header.data_size) {
-      Rf_warning("early EOF in chunk %ld at cindex=%ld",
-          chunk+1, cindex-header.header_size);
+    if (!keep && skip_unwanted) {
+      cindex += header.data_size;
+      continue;
+    }
+    const unsigned char *data = mf.span(cindex, header.data_size);
+    if (!data) {
+      Rf_warning("early EOF in chunk %lld at cindex=%lld",
+          record, cindex-header.header_size);
       break; // give up
     }
+    if (keep) {
+      start_buf[chunk] = record_start;
+      index_buf[chunk] = cindex;
+      header_length_buf[chunk] = header.header_size;
+      data_length_buf[chunk] = header.data_size;
+      id_buf[chunk] = header.id;
+      time_buf[chunk] = ad2cp_record_time(data, header.data_size, header.id);
+      chunk++;
+    }
     cindex += header.data_size;
     // Compare data checksum to the value stated in the header
     unsigned short dbufcs;
-    dbufcs = cs(dbuf, header.data_size, debug);
-    //if (ignoreChecksums[0] > 0 || dbufcs == header.data_checksum) {
+    dbufcs = cs(data, header.data_size, debug);
     if (dbufcs == header.data_checksum) {
-      //cindex_last_good = cindex - header.header_size - header.data_size;
-      reset_cindex = 0;
-      if (debug > 1) {
-        if (dbufcs == header.data_checksum) {
-          Rprintf("    cindex=%d: data checksum 0x%02x equals expectation\n", cindex, dbufcs);
-        } else {
-          Rprintf("    cincex=%d: data checksum 0x%02x disagrees with expectation 0x%02x\n", cindex, dbufcs, header.data_checksum);
-        }
-      }
+      if (debug > 1)
+        Rprintf("    cindex=%lld: data checksum 0x%02x equals expectation\n", cindex, dbufcs);
     } else {
+      if (checksum_failures < 128)
+        failure_buf[checksum_failures] = cindex - header.data_size;
       checksum_failures++;
-      Rprintf("ERROR: data checksum, 0x%02x, disagrees with expectation, 0x%02x, at cindex=%ld.\n",
+      Rprintf("ERROR: data checksum, 0x%02x, disagrees with expectation, 0x%02x, at cindex=%lld.\n",
           dbufcs, header.data_checksum, cindex);
-      if (cindex != ftell(fp))
-        Rprintf("  *BUG*: cindex=%ld is out of synch with ftell(fp)=%ld\n", cindex, ftell(fp));
-
-      while (1) {
-        c = getc(fp);
-        cindex++;
-        if (debug)
-          Rprintf("cindex=%5d c=0x%02x\n", cindex, c);
-        if (c == EOF) {
-          Rprintf("... got to end of file while searching for a sync character (0x%02x)\n", SYNC);
-          early_EOF = 1;
-          break;
-        }
-        if (c == SYNC) {
-          //unsigned int trial_cindex = cindex; // so we can reset to here if this trial works
-          Rprintf("... got a sync character (0x%02x) at cindex=%d (%7.4f%% through file)\n",
-              SYNC, cindex, 100.0*cindex/filesize);
-          // header size (should be 10 or 12)
-          int trial_header_size = getc(fp);
-          cindex++;
-          if (trial_header_size == EOF) {
-            Rprintf("    got to end of file while searching for a header-size character at cindex=%ld\n", cindex);
-            early_EOF = 1;
-            break;
-          }
-          if (trial_header_size != 10 && trial_header_size != 12) {
-            Rprintf("    header-size is %d, not 10 or 12 as expected\n", trial_header_size);
-            continue;
-          }
-          //Rprintf("  DAN DAN DAN trial_header_size=%d\n", trial_header_size);
-          //. Rprintf("        proper header-size character (either 10 or 20 decimal)\n");
-          // Skip over the id byte, which has many possibilities we know of (and perhaps more),
-          // so it is a bit hard to check for correctness.
-          c = getc(fp);
-          cindex++;
-          if (c == EOF) {
-            Rprintf("got to end of file while searching for an 'id' byte\n");
-            early_EOF = 1;
-            break;
-          }
-          // family: assume it's the same for the whole file.
-          c = getc(fp);
-          cindex++;
-          if (c == EOF) {
-            Rprintf("got to end of file while searching for a the 'family' byte\n");
-            early_EOF = 1;
-            break;
-          }
-          if (c == family) {
-            //. Rprintf("            family=%d is consistent with previous family\n", family, cindex);
-            cindex -= 4;
-            fseek(fp, -4, SEEK_CUR);
-            Rprintf("   ... skipped forward to a possible header at cindex=%ld\n", cindex);
-            if (cindex != ftell(fp))
-              Rprintf("  *BUG*: cindex=%ld is out of synch with ftell(fp)=%ld\n", cindex, ftell(fp));
-            break;
-          } else {
-            Rprintf(" expecting family (0x%02x) but got 0x%02x at cindex=%d\n",
-                family, c, cindex);
-          }
-        }
-      }
-      if (early_EOF == 1)
+      cindex = ad2cp_resync(mf, cindex, family, (double)filesize);
+      if (cindex < 0) {
+        // No record follows the damaged one, so drop it, as the
+        // checksum cannot vouch for its contents.
+        if (keep)
+          chunk--;
+        early_EOF = 1;
         break; // give up on further processing
+      }
     }
-    if (!reset_cindex) {
-      chunk++;
+  }
+#undef AD2CP_ERROR
+  mf.close();
+  // The scan kept every record, so save them, and then select the
+  // wanted ones.
+  if (build_index) {
+    ix.entries.resize((size_t)chunk);
+    for (long long i = 0; i < chunk; i++) {
+      ad2cp_index_entry& e = ix.entries[i];
+      e.start = start_buf[i];
+      e.index = index_buf[i];
+      e.header_length = header_length_buf[i];
+      e.data_length = data_length_buf[i];
+      e.id = id_buf[i];
+      e.time = time_buf[i];
     }
+    ix.checksum_failures.assign(failure_buf, failure_buf + (checksum_failures < 128 ? checksum_failures : 128));
+    ix.early_EOF = early_EOF;
+    if (ad2cp_index_write(index_name.c_str(), fn.c_str(), ix))
+      Rprintf("Warning: cannot write index file '%s'\n", index_name.c_str());
+    else if (debug)
+      Rprintf("  wrote %d-record index file '%s'\n", (int)ix.entries.size(), index_name.c_str());
+    chunk = ad2cp_select(ix, wanted,
+        start_buf, index_buf, header_length_buf, data_length_buf, id_buf, time_buf);
   }
-  IntegerVector start(chunk), index(chunk), header_length(chunk), data_length(chunk), id(chunk);
-  for (unsigned int i = 0; i < chunk; i++) {
-    start[i] = start_buf[i];
-    index[i] = index_buf[i];
+  NumericVector start(chunk), index(chunk), time(chunk);
+  IntegerVector header_length(chunk), data_length(chunk), record_id(chunk);
+  for (long long int i = 0; i < chunk; i++) {
+    start[i] = (double)start_buf[i];
+    index[i] = (double)index_buf[i];
     header_length[i] = header_length_buf[i];
     data_length[i] = data_length_buf[i];
-    id[i] = id_buf[i];
+    record_id[i] = id_buf[i];
+    time[i] = ISNAN(time_buf[i]) ? NA_REAL : time_buf[i];
   }
   // Delete the temporary (_buf) storage items.
   R_Free(start_buf);
@@ -453,6 +574,7 @@ List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerV
   R_Free(header_length_buf);
   R_Free(data_length_buf);
   R_Free(id_buf);
+  R_Free(time_buf);
   if (debug)
     Rprintf("} # do_ldc_ad2cp_in_file()\n");
   return(List::create(
@@ -460,8 +582,8 @@ List do_ldc_ad2cp_in_file(CharacterVector filename, IntegerVector from, IntegerV
         Named("index")=index,
         Named("headerLength")=header_length,
         Named("dataLength")=data_length,
-        Named("id")=id,
+        Named("id")=record_id,
+        Named("time")=time,
         Named("checksumFailures")=checksum_failures,
         Named("earlyEOF")=early_EOF));
 }
-
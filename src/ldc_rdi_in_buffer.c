@@ -4,6 +4,7 @@
 #include <R.h>
 #include <Rdefines.h>
 #include <Rinternals.h>
+#include "checksum.h"
 
 
 //#define DEBUG
@@ -50,27 +51,22 @@ SEXP ldc_rdi_in_buffer(SEXP buf, SEXP max)
   int max_lres = *INTEGER_POINTER(max);
   if (max_lres < 0)
     error("'max' must be positive");
-  int lres;
-  int lbuf = LENGTH(buf);
+  R_xlen_t lres;
+  R_xlen_t lbuf = XLENGTH(buf);
   SEXP res;
   /* Count matches, so we can allocate the right length */
   unsigned char byte1 = 0x7f;
   unsigned char byte2 = 0x7f; /* this equal 22 base 10, i.e. the number of bytes in record */
-  int matches = 0;
+  R_xlen_t matches = 0;
   unsigned short int check_sum, desired_check_sum;
   unsigned int bytes_to_check = 0;
   // Step 1: count matches (i.e. determine lres)
-  for (int i = 0; i < lbuf - 1; i++) { /* note that we don't look to the very end */
+  for (R_xlen_t i = 0; i < lbuf - 3; i++) { /* note that we don't look to the very end */
     if (pbuf[i] == byte1 && pbuf[i+1] == byte2) { /* match first 2 bytes, now check the checksum */
       R_CheckUserInterrupt();
       bytes_to_check = (unsigned int)(pbuf[i+2]) + 256 * (unsigned int)(pbuf[i+3]);
-      if ((i + bytes_to_check) < lbuf) {
-        check_sum = 0;
-        for (int ic = 0; ic < bytes_to_check; ic++) {
-          check_sum += (unsigned short int)pbuf[i + ic];
-          //if (matches < 1 && (ic < 5 || ic > (bytes_to_check-10)))
-          //if (matches==LOOK) Rprintf("  ic %d, byte 0x%02x, check_sum %d [OLD METHOD]\n", ic, pbuf[i+ic], check_sum);
-        }
+      if ((i + bytes_to_check + 1) < lbuf) {
+        check_sum = oce_checksum_bytes(pbuf + i, bytes_to_check, 0);
         desired_check_sum = ((unsigned short int)pbuf[i+bytes_to_check]) | ((unsigned short int)pbuf[i+bytes_to_check+1] << 8);
         if (check_sum == desired_check_sum) {
           matches++;
@@ -88,12 +84,12 @@ SEXP ldc_rdi_in_buffer(SEXP buf, SEXP max)
   lres = matches;
   //Rprintf("OLD: got %d matches\n", matches);
   if (lres > 0) {
-    PROTECT(res = NEW_INTEGER(lres));
-    int *pres = INTEGER_POINTER(res);
-    for (int i = 0; i < lres; i++)
+    PROTECT(res = NEW_NUMERIC(lres));
+    double *pres = NUMERIC_POINTER(res);
+    for (R_xlen_t i = 0; i < lres; i++)
       pres[i] = 0; // set to zero as a check
-    int ires = 0;
-    for (int i = 0; i < lbuf - 1; i++) { /* note that we don't look to the very end */
+    R_xlen_t ires = 0;
+    for (R_xlen_t i = 0; i < lbuf - 3; i++) { /* note that we don't look to the very end */
       if (pbuf[i] == byte1 && pbuf[i+1] == byte2) { /* match first 2 bytes, now check the checksum */
         R_CheckUserInterrupt();
         bytes_to_check = (unsigned int)pbuf[i+2] + 256 * (unsigned int)pbuf[i+3];
@@ -101,12 +97,8 @@ SEXP ldc_rdi_in_buffer(SEXP buf, SEXP max)
         // ires, i, (int)pbuf[i+2], (int)pbuf[i+3], bytes_to_check);
         //if (bytes_to_check > 1000) Rprintf("OLD i=%d ires=%d odd b1=%d b2=%d bytes_to_check=%d\n",
         //    i, ires, (int)pbuf[i+2], (int)pbuf[i+3], bytes_to_check);
-        if ((i + bytes_to_check) < lbuf) {
-          check_sum = 0;
-          for (int ic = 0; ic < bytes_to_check; ic++) {
-            check_sum += (unsigned short int)pbuf[i + ic];
-            //if (SHOW(ires)) Rprintf("OLD ires=%d ic=%d check_sum=%d\n", ires, ic, check_sum);
-          }
+        if ((i + bytes_to_check + 1) < lbuf) {
+          check_sum = oce_checksum_bytes(pbuf + i, bytes_to_check, 0);
           desired_check_sum = ((unsigned short int)pbuf[i+bytes_to_check]) | ((unsigned short int)pbuf[i+bytes_to_check+1] << 8);
           //if (SHOW(ires)) Rprintf("OLD ires=%d check_sum=%d desired_check_sum=%d bytes_to_check=%d\n",
           //ires, check_sum, desired_check_sum, bytes_to_check);
@@ -121,13 +113,13 @@ SEXP ldc_rdi_in_buffer(SEXP buf, SEXP max)
           break;
         }
         i += bytes_to_check+1; // skip to the next ensemble
-        if (pbuf[i+1] != byte1) Rprintf("pbuf[%d] is 0x%02x, not 0x%02x\n", i+1, pbuf[i+1], byte1);
-        if (pbuf[i+2] != byte1) Rprintf("pbuf[%d] is 0x%02x, not 0x%02x\n", i+2, pbuf[i+2], byte1);
+        if (i + 2 < lbuf && pbuf[i+1] != byte1) Rprintf("pbuf[%lld] is 0x%02x, not 0x%02x\n", (long long)(i+1), pbuf[i+1], byte1);
+        if (i + 2 < lbuf && pbuf[i+2] != byte1) Rprintf("pbuf[%lld] is 0x%02x, not 0x%02x\n", (long long)(i+2), pbuf[i+2], byte1);
       }
     }
   } else {
-    PROTECT(res = NEW_INTEGER(1));
-    int *pres = INTEGER_POINTER(res);
+    PROTECT(res = NEW_NUMERIC(1));
+    double *pres = NUMERIC_POINTER(res);
 #ifdef DEBUG
     Rprintf("lres <= 0; setting pres to 0 (does that get checked?)\n");
 #endif
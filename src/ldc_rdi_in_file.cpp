@@ -3,7 +3,19 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 #include <Rcpp.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "checksum.h"
+#include "civil_time.h"
+#include "mapped_file.h"
+#include "rdi_index.h"
 
 using namespace Rcpp;
 
@@ -43,19 +55,16 @@ static int warnings = 10;
 // GPL, I reason that it's OK to use it here, modified from the C++
 // form (using references) to a C form (likely similar to that used
 // within R, but I didn't check on that).
+// Until version 1.8-2, the number of days since 1970 was found by
+// adding up the lengths of the intervening years, but now it is found
+// with oce_days_from_civil() (see civil_time.h), which takes the same
+// time for any year.
 // Note that this returns a double, which we cast to a time_t.
 double oce_timegm(struct tm *t)
 {
-  static const int days_in_month[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  static const int days_before_month[13] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};
   static const int year_base = 1900;
-#define isleap(y) ((((y) % 4) == 0 && ((y) % 100) != 0) || ((y) % 400) == 0)
-#define days_in_year(year) (isleap(year) ? 366 : 365)
-  int day = 0;
-  int i, year, year0;
-  double excess = 0.0;
-
-  day = t->tm_mday - 1;
-  year0 = year_base + t->tm_year;
+  int year0 = year_base + t->tm_year;
   // FIXME: is there a better way to decide when results are odd?
   // FIXME: Should this be a user-controlled thing at the read.adp.rdi()
   // FIXME: level, in R?
@@ -66,37 +75,18 @@ double oce_timegm(struct tm *t)
     }
     year0 = year0 - 100;
   }
-  /* safety check for unbounded loops */
-  if (year0 > 3000) {
-    excess = (int)(year0/2000) - 1;
-    year0 -= excess * 2000;
-  } else if (year0 < 0) {
-    excess = -1 - (int)(-year0/2000);
-    year0 -= excess * 2000;
-  }
-
-  for(i = 0; i < t->tm_mon; i++)
-    day += days_in_month[i];
-  if (t->tm_mon > 1 && isleap(year0))
+  int mon = t->tm_mon < 0 ? 0 : (t->tm_mon > 12 ? 12 : t->tm_mon); // damaged data
+  int day = t->tm_mday - 1 + days_before_month[mon];
+  if (t->tm_mon > 1 && oce_is_leap(year0))
     day++;
   t->tm_yday = day;
-
-  if (year0 > 1970) {
-    for (year = 1970; year < year0; year++)
-      day += days_in_year(year);
-  } else if (year0 < 1970) {
-    for (year = 1969; year >= year0; year--)
-      day -= days_in_year(year);
-  }
+  long long days = oce_days_from_civil(year0, 1, 1) + day;
 
   /* weekday: Epoch day was a Thursday */
-  if ((t->tm_wday = (day + 4) % 7) < 0)
+  if ((t->tm_wday = (int)((days + 4) % 7)) < 0)
     t->tm_wday += 7;
 
-  return t->tm_sec + (t->tm_min * 60) + (t->tm_hour * 3600)
-    + (day + excess * 730485) * 86400.0;
-#undef isleap
-#undef days_in_year
+  return t->tm_sec + (t->tm_min * 60) + (t->tm_hour * 3600) + days * 86400.0;
 }
 
 
@@ -125,12 +115,62 @@ because of limitations on the size of vectors in R, which is set by
 the R use of 32-bit integers. (Note: 2^32-1 corresponds to a data file
 of roughly 4.3Gb.)
 
+Until version 1.8-2, the file was read with fgetc() and fread(),
+and checksums were computed on a copy of each ensemble. Now the file
+is memory-mapped (see mapped_file.h), so that 0x7f 0x7f pairs are
+found with memchr() and checksums are computed on the mapped pages.
+Where mapping is not possible, the file is read through a buffer.
+The results, including the recovery from damaged ensembles (issue
+1437), are unchanged.
+
+Also in version 1.8-2, the optional 'indexFile' argument was added.
+If it is not empty, and names an index that matches the data file (see
+rdi_index.h), then the ensemble locations are taken from the index,
+with no scan of the file. Otherwise, the whole file is scanned (even
+if 'to' indicates that the results are needed only for a part of it),
+and the index is written for use in later calls.
+
+Also in version 1.8-2, time-based selection (mode=1) without an index
+began with a bisection on file offset (see rdi_seek_time()), so that
+reading a short interval near the end of a long file does not require
+scanning the whole file.
+
+Also in version 1.8-2, the optional 'threads' argument was added, to
+permit scanning the file with several threads (see rdi_scan_parallel()).
+
+Also in version 1.8-2, checksums began to be computed with SIMD
+instructions, where the processor supports them (see checksum.h).
+
+Also in version 1.8-2, the optional 'cursor' argument was added, and a
+"cursor" item was added to the return value, for reading files that
+are still being written (e.g. by VMDAS or WinRiver on a ship).
+
+Also in version 1.8-2, the selected ensembles began to be copied
+straight from the file into the returned "buf", after the scan,
+instead of being gathered in a growable C buffer and then copied into
+"buf". This halves the memory needed for large selections.
+
+Also in version 1.8-2, file offsets began to be held in 64-bit
+integers, and "ensembleStart" and "ensemble_in_file" began to be
+returned as numeric (double) vectors, instead of integer vectors, so
+that files (and selections) larger than 2 GiB can be read.
+
+Also in version 1.8-2, 'filename' may name several files, which are
+treated as one stream of bytes (see mapped_file.h). This is for long
+deployments that were recorded as a sequence of files (.000, .001,
+...), and it means that an ensemble split between two files is not
+lost. Since the files are scanned in one pass, 'from', 'to' and 'by'
+apply to the ensembles of all the files, and the output is sized just
+once. With several files, 'indexFile' is ignored, and the scan uses a
+single thread.
+
 THIS IS A FUNCTION STILL IN DEVELOPMENT, and much of what is said
 about the behaviour is aspirational. At present, it reads the *whole*
 file, ignoring all arguments except the file name.
 
-@param filename character string indicating the name of an RDI adp
-file.
+@param filename character vector holding the name of an RDI adp
+file, or the names of several files that are to be read as one, in
+the order given.
 
 @param from integer giving the index of the first ensemble (AKA
 profile) to retrieve. The R notation is used, i.e. from=1 means the
@@ -149,14 +189,35 @@ means to get every second profile.
 @param mode integer, 0 if 'from' etc are profile numbers or 1 if they
 are the numerical values of unix times.
 
+@param indexFile character string naming an index file, or "" to
+avoid the use of an index.
+
+@param threads integer giving the number of threads to use for
+scanning the file, or 0 to use the OpenMP default. Values other
+than 1 are ignored if the package was built without OpenMP, if the
+file cannot be memory-mapped, or if there are several files.
+
+@param cursor numeric vector, either empty or holding the "cursor" item
+returned by a previous call. In the latter case, the scan starts just
+after the last ensemble found in that call, and the ensembles are
+numbered on from the count held in the cursor, so that (for mode=0)
+'from' and 'to' are ensemble numbers counted from the start of the
+file, not from the cursor (if the count is NA, e.g. after a bisection,
+the numbering restarts at 1). Also, 'indexFile' and 'threads' are
+ignored, since an index would go out of date as the file grows.
+
 @param debug integer, 1 or higher to turn on printing. Note that the R function
 subtracts 1 from the debug level, before calling this C++ fucction. In other
 words, calling `read.adp.rdi(...,debug=1)` does not turn debuggin on,
 but calling `read.adp.rdi(...,debug=2)` does.
 
 @value a list containing "ensembleStart", "time", "sec100", and "buf",
-and "ensemble_in_file", which are used in the calling R
-function, read.adp.rdi().
+and "ensemble_in_file" (an offset into the stream made up of all the
+files, if there are several), which are used in the calling R
+function, read.adp.rdi(), along with "cursor", which holds the file
+offset just past the last ensemble that was examined, the number of
+ensembles in the file up to that point (NA if not known, e.g. after a
+bisection), and the length of that ensemble, for use in a later call.
 
 @examples
 
@@ -184,21 +245,503 @@ Dan Kelley
 
 */
 
+// The state of the ensemble locator, carried from one call of
+// rdi_next_ensemble() to the next. The scheme mimics the byte-by-byte
+// reading that was used before the file was memory-mapped, so that
+// the recovery from damaged ensembles (issue 1437) is unchanged.
+typedef struct {
+  long long pos;                    // file offset of next byte to examine
+  int clast;                        // byte before 'pos' (EOF at end of file)
+  unsigned int bytes_to_check_last; // length of the most recent good ensemble
+  int quiet;                        // 1 to skip printing and interrupt checks
+  int tail;                         // 1 if the file may still be growing
+  std::vector<std::string> *log;    // if not NULL, where messages are saved
+} rdi_locator;
+
+// Print a message about a damaged ensemble or the end of the data, or
+// save it in the locator's log, if it has one, so that it can be
+// printed later (and outside any thread).
+static void rdi_report(rdi_locator *loc, const char *format, ...)
+{
+  if (loc->quiet && !loc->log)
+    return;
+  char msg[256];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(msg, sizeof(msg), format, ap);
+  va_end(ap);
+  if (loc->log)
+    loc->log->push_back(msg);
+  else
+    Rprintf("%s", msg);
+}
+
+static int rdi_getc(MappedFile& mf, rdi_locator *loc)
+{
+  int c = mf.byte(loc->pos);
+  if (c != EOF)
+    loc->pos++;
+  return c;
+}
+
+// Find the next ensemble that has a good checksum, returning 1 if one
+// is found (in which case 'start' is the file offset of its 0x7f 0x7f
+// byte pair, and 'bytes_to_check' is the number of bytes that enter the
+// checksum), 0 at the end of the file, or -1 if the ensemble length
+// cannot be decoded. An ensemble that is cut off by the end of the
+// file is not checked, so if the file is still being written, the
+// partial ensemble at its end is found on a later call, once it is
+// complete.
+static int rdi_next_ensemble(MappedFile& mf, rdi_locator *loc,
+    long long *start, unsigned int *bytes_to_check, int debug_value)
+{
+  const int byte1 = 0x7f, byte2 = 0x7f;
+  if (loc->clast == EOF) // the file ended just after the previous ensemble
+    return 0;
+  while (1) {
+    int c = rdi_getc(mf, loc);
+    if (c == EOF) {
+      if (!loc->tail)
+        rdi_report(loc, "Got to end of data while trying to read the first header byte of an RDI file (cindex=%lld)\n", loc->pos);
+      return 0;
+    }
+    if (loc->clast == byte1 && c == byte2) {
+      long long last7f7f = loc->pos - 2;
+      if (debug_value > 0)
+        Rprintf("0x7f 0x7f at position %lld\n", last7f7f);
+      int b1 = rdi_getc(mf, loc);
+      if (b1 == EOF) {
+        if (!loc->tail)
+          rdi_report(loc, "Got to end of data while trying to read the 'b1' byte of an RDI file (cindex=%lld; last7f7f=%lld)\n", loc->pos, last7f7f);
+        return 0;
+      }
+      int b2 = rdi_getc(mf, loc);
+      if (b2 == EOF) {
+        if (!loc->tail)
+          rdi_report(loc, "Got to end of data while trying to read the 'b2' byte of an RDI file (cindex=%lld; last7f7f=%lld)\n", loc->pos, last7f7f);
+        return 0;
+      }
+      // The checksum includes the starting (0x7f, 0x7f) sequence, the
+      // two bytes that specify the number of bytes in the ensemble, and
+      // the data in the ensemble (sans the two bytes at the end of the
+      // data, which store the checksum).
+      unsigned int btc = (unsigned int)b1 + 256 * (unsigned int)b2;
+      if (debug_value > 0)
+        Rprintf("\nbytes_to_check=%d based on b1=%d(0x%02x) and b2=%d(0x%02x)\n", btc, b1, b1, b2, b2);
+      if (btc < 5) // this will only happen in error
+        return -1;
+      unsigned int bytes_to_read = btc - 4; // byte1&byte2&check_sum used 4 bytes already
+      const unsigned char *body = mf.span(loc->pos, bytes_to_read);
+      if (!body) {
+        if (!loc->tail)
+          rdi_report(loc, "Got to end of data while trying to read an RDI file (cindex=%lld; last7f7f=%lld)\n", loc->pos, last7f7f);
+        return 0;
+      }
+      // Sum the bytes where they sit in the file mapping.
+      unsigned short int check_sum = oce_checksum_bytes(body, bytes_to_read,
+          (unsigned short int)(byte1 + byte2 + b1 + b2));
+      loc->pos += bytes_to_read;
+      int cs1 = rdi_getc(mf, loc);
+      if (cs1 == EOF) {
+        if (!loc->tail)
+          rdi_report(loc, "Got to end of data while trying to get the first checksum byte in an RDI file (cindex=%lld; last7f7f=%lld)\n", loc->pos, last7f7f);
+        return 0;
+      }
+      int cs2 = rdi_getc(mf, loc);
+      if (cs2 == EOF) {
+        if (!loc->tail)
+          rdi_report(loc, "Got to end of data while trying to get second checksum byte in an RDI file (cindex=%lld; last7f7f=%lld)\n", loc->pos, last7f7f);
+        return 0;
+      }
+      unsigned short int desired_check_sum = ((unsigned short int)cs1) | ((unsigned short int)(cs2 << 8));
+      if (check_sum == desired_check_sum) {
+        if (debug_value > 0)
+          Rprintf("good checksum at cindex=%lld (check_sum=%d desired_check_sum=%d bytes_to_read=%d last7f7f=%lld)\n",
+              loc->pos, check_sum, desired_check_sum, bytes_to_read, last7f7f);
+        loc->bytes_to_check_last = btc; // use later, if find bad checksum (issue 1437)
+        loc->clast = rdi_getc(mf, loc); // ready for next call
+        *start = last7f7f;
+        *bytes_to_check = btc;
+        return 1;
+      }
+      rdi_report(loc, "Warning: bad checksum at byte %lld in file (check_sum=%d desired_check_sum=%d bytes_to_read=%d bytes_to_read_last=%d)\n",
+            loc->pos, check_sum, desired_check_sum, bytes_to_read, loc->bytes_to_check_last);
+      // maybe the number of bytes to check was wrong (issue 1437)
+      if (loc->bytes_to_check_last != btc) {
+        if (debug_value > 0)
+          Rprintf("the problem may be that length (%d bytes) disagrees with previous (%d bytes)\n", btc, loc->bytes_to_check_last);
+        // Skip to just past the last 7f7f, and then start looking
+        // for the next valid 7f7f.
+        loc->pos = last7f7f;
+        loc->clast = 0;
+        for (unsigned int iii = 0; iii < 2 * loc->bytes_to_check_last; iii++) {
+          c = rdi_getc(mf, loc);
+          if (loc->clast == byte1 && c == byte2) {
+            if (debug_value > 0)
+              Rprintf(" got 7f 7f again at byte %lld, after realigning. FYI bytes_to_check_last=%d\n", loc->pos, loc->bytes_to_check_last);
+            // check if next two bytes give the expected length as before
+            b1 = rdi_getc(mf, loc);
+            b2 = rdi_getc(mf, loc);
+            btc = (unsigned int)b1 + 256 * (unsigned int)b2;
+            if (btc == loc->bytes_to_check_last) {
+              loc->pos -= 2;
+              rdi_report(loc, "    ... recovered from bad checksum by restarting at byte %lld in file\n", loc->pos);
+              break;
+            } else {
+              if (debug_value > 0)
+                Rprintf(" ACCIDENTALLY MATCH since bytes_to_check=%d, not expected %d\n", btc, loc->bytes_to_check_last);
+            }
+          }
+          loc->clast = c;
+        }
+      }
+    } else {
+      // Either clast != byte1 or c != byte2, so skip forward to the
+      // next 0x7f 0x7f pair, looking no further than twice the length
+      // of the last good ensemble.
+      rdi_report(loc, "Warning: bad ensemble-start byte-pair at byte %lld in file\n", loc->pos);
+      long long look = 2 * (long long)loc->bytes_to_check_last;
+      if (look > 0) {
+        // As in the byte-by-byte version of this code, the first pair
+        // that is considered is made up of the byte *before* 'c', and
+        // the byte after it.
+        long long found = -1; // offset, from loc->pos, of the second byte of the pair
+        if (loc->clast == byte1 && mf.byte(loc->pos) == byte2) {
+          found = 0;
+        } else {
+          long long n = look;
+          if (n > mf.size() - loc->pos)
+            n = mf.size() - loc->pos;
+          const unsigned char *p = mf.span(loc->pos, n);
+          long long k = p ? find_byte_pair(p, n, byte1, byte2) : -1;
+          if (k >= 0)
+            found = k + 1;
+        }
+        if (found >= 0) {
+          loc->pos += found + 1;
+          if (debug_value > 0)
+            Rprintf(" got 7f 7f again at byte %lld, after skipping. FYI bytes_to_check_last=%d\n", loc->pos, loc->bytes_to_check_last);
+          rdi_report(loc, "    ... recovered from bad ensemble-start byte-pair by restarting at byte %lld in file\n", loc->pos);
+          loc->pos -= 2;
+        } else {
+          loc->pos += look;
+          if (loc->pos > mf.size())
+            loc->pos = mf.size();
+        }
+      }
+      if (debug_value > 0)
+        Rprintf("====\n");
+    }
+    if (!loc->quiet)
+      R_CheckUserInterrupt(); // only check once per ensemble, for speed
+    loc->clast = rdi_getc(mf, loc);
+    if (loc->clast == EOF)
+      return 0;
+  }
+}
+
+// Compute the time of the ensemble starting at 'start', from the
+// variable leader, whose offset from the start of the ensemble is
+// stored in bytes 8 and 9. If 'sec100' is not NULL, it is set to the
+// hundredths of a second. This is the only place where times are
+// worked out, so that all the ways of finding ensembles agree.
+static time_t rdi_ensemble_time(MappedFile& mf, long long start, int *sec100)
+{
+  struct tm etime;
+  long long time_pointer = start + 4 + (unsigned int)mf.byte(start + 8) + 256 * (unsigned int)mf.byte(start + 9);
+  etime.tm_year = 100 + mf.byte(time_pointer+0);
+  etime.tm_mon = -1 + mf.byte(time_pointer+1);
+  etime.tm_mday = mf.byte(time_pointer+2);
+  etime.tm_hour = mf.byte(time_pointer+3);
+  etime.tm_min = mf.byte(time_pointer+4);
+  etime.tm_sec = mf.byte(time_pointer+5);
+  etime.tm_isdst = 0;
+  if (sec100)
+    *sec100 = mf.byte(time_pointer+6);
+  // Use local timegm code, which I suppose is risky, but it
+  // does not seem that Microsoft Windows provides this function
+  // in a workable form.
+  return (time_t)oce_timegm(&etime);
+}
+
+// The ensemble number, from bytes 2, 3 and 11 of the variable leader.
+static unsigned int rdi_ensemble_number(MappedFile& mf, long long start)
+{
+  long long vl = start + (unsigned int)mf.byte(start + 8) + 256 * (unsigned int)mf.byte(start + 9);
+  return (unsigned int)mf.byte(vl+2) + 256 * (unsigned int)mf.byte(vl+3) + 65536 * (unsigned int)mf.byte(vl+11);
+}
+
+static void rdi_index_save(std::string& index_name, std::string& fn, long long start_index,
+    std::vector<rdi_index_entry>& index, int debug_value)
+{
+  if (rdi_index_write(index_name.c_str(), fn.c_str(), start_index, index))
+    Rprintf("Warning: cannot write index file '%s'\n", index_name.c_str());
+  else if (debug_value > 0)
+    Rprintf("wrote %d-ensemble index file '%s'\n", (int)index.size(), index_name.c_str());
+}
+
+// Bytes searched for a 0x7f 0x7f pair in each call to span(), which
+// bounds the window in the unmapped case.
+#define SEARCH_CHUNK 4194304
+
+// Find the first ensemble that starts at or after 'pos', returning its
+// offset, or -1 if there is none. To be accepted, an ensemble must
+// have a good checksum, and it must be followed either by the end of
+// the file or by another 0x7f 0x7f pair; the second test guards
+// against 0x7f 0x7f pairs (with a chance checksum match) within data.
+static long long rdi_resync(MappedFile& mf, long long pos)
+{
+  long long size = mf.size();
+  while (pos < size - 1) {
+    // Search chunk by chunk, and file by file if there are several,
+    // checking for a pair that is split between two chunks.
+    long long n = mf.run(pos);
+    if (n > SEARCH_CHUNK)
+      n = SEARCH_CHUNK;
+    const unsigned char *p = mf.span(pos, n);
+    if (!p)
+      return -1;
+    long long k = find_byte_pair(p, n, 0x7f, 0x7f);
+    if (k < 0) {
+      if (pos + n >= size)
+        return -1;
+      if (p[n - 1] != 0x7f || mf.byte(pos + n) != 0x7f) {
+        pos += n;
+        continue;
+      }
+      k = n - 1;
+    }
+    long long start = pos + k;
+    unsigned int btc = (unsigned int)mf.byte(start + 2) + 256 * (unsigned int)mf.byte(start + 3);
+    const unsigned char *e = btc >= 5 ? mf.span(start, btc + 2) : NULL;
+    if (e) {
+      unsigned short int check_sum = oce_checksum_bytes(e, btc, 0);
+      unsigned short int desired_check_sum = (unsigned short int)(e[btc] | (e[btc+1] << 8));
+      long long next = start + btc + 2;
+      if (check_sum == desired_check_sum
+          && (next == size || (mf.byte(next) == 0x7f && mf.byte(next + 1) == 0x7f)))
+        return start;
+    }
+    pos = start + 1;
+  }
+  return -1;
+}
+
+// Find a place to start scanning for the ensembles with times at or
+// after 'from', by bisection on file offset. This relies on times
+// increasing through the file, which they do in practice. The result
+// is the offset of an ensemble whose time is before 'from', and that
+// lies no more than 'slack' bytes before the first ensemble at or
+// after 'from', so that the scan from there to the start of the time
+// window is short. If no such ensemble can be found, the result is
+// 'lo', meaning that the scan should start at the usual place. The
+// ensembles before the result are not examined, so any damage among
+// them is not reported, as it would be by a scan from the start.
+static long long rdi_seek_time(MappedFile& mf, long long lo, time_t from, int debug_value)
+{
+  const long long slack = 65536; // a few ensembles, for typical files
+  int saved_warnings = warnings;
+  warnings = 0; // do not warn about odd years from probes
+  long long start = rdi_resync(mf, lo);
+  if (start != lo || rdi_ensemble_time(mf, lo, NULL) >= from) {
+    warnings = saved_warnings;
+    return lo;
+  }
+  long long hi = mf.size();
+  int probes = 0;
+  while (hi - lo > slack) {
+    long long mid = lo + (hi - lo) / 2;
+    start = rdi_resync(mf, mid);
+    probes++;
+    if (start < 0 || start >= hi) {
+      hi = mid;
+    } else if (rdi_ensemble_time(mf, start, NULL) < from) {
+      lo = start;
+    } else {
+      hi = mid;
+    }
+    R_CheckUserInterrupt();
+  }
+  warnings = saved_warnings;
+  if (debug_value > 0)
+    Rprintf("bisection on time took %d probes, and will start the scan at byte %lld\n", probes, lo);
+  return lo;
+}
+
+// Multi-threaded scanning.
+//
+// The ensembles found by rdi_next_ensemble() form a chain, in which
+// each ensemble determines the next one, because the state of the
+// locator after a good ensemble depends only on where that ensemble
+// starts. Thus, if two scans ever land on the same ensemble, they will
+// agree from there on. We use this to split the work. The file is
+// divided into segments, and a thread scans each segment, starting at
+// the first good ensemble in it (or at the usual place, for the first
+// segment), and continuing until it reaches an ensemble that starts in
+// the next segment. Then, working through the segments in order, we
+// look for the last ensemble of the chain built so far within the
+// chain of the next segment. If it is found, that chain is adopted;
+// if not (which can happen if a damaged region makes the chains
+// differ), the scan continues serially through the segment. Either
+// way, the result is the same as from a serial scan, including the
+// recovery from damaged ensembles (issue 1437).
+//
+// The threads must not call R, so they use quiet locators, which save
+// their messages about damaged ensembles in the chain, tagged with the
+// number of the ensemble that was being sought. The messages that a
+// serial scan would have printed are kept with the final chain, and
+// they are printed as its ensembles are used, so that they appear as
+// they would in a serial scan. The threads also need the file to be
+// memory-mapped, because the windowed reading scheme of MappedFile is
+// not thread-safe.
+
+typedef struct {
+  std::vector<long long> start;          // ensemble starts, increasing
+  std::vector<unsigned int> bytes_to_check;
+  int end;                               // how the chain ended (see below)
+  std::vector<std::string> message;      // messages from a quiet locator
+  std::vector<size_t> message_entry;     // chain length when each was saved
+} rdi_chain;
+#define CHAIN_NEXT_SEGMENT 0 // last entry starts in the next segment
+#define CHAIN_EOF 1          // the end of the file was reached
+#define CHAIN_ERROR 2        // an ensemble length could not be decoded
+
+// Extend 'chain' from the locator state 'loc', until reaching an
+// ensemble that starts at or after 'end', or the end of the file.
+static void rdi_chain_extend(MappedFile& mf, rdi_locator *loc, long long end, rdi_chain *chain, int debug_value)
+{
+  long long start;
+  unsigned int bytes_to_check;
+  loc->log = &chain->message;
+  while (1) {
+    int found = rdi_next_ensemble(mf, loc, &start, &bytes_to_check, debug_value);
+    // Tag the new messages with the number of the ensemble that was
+    // being sought.
+    chain->message_entry.resize(chain->message.size(), chain->start.size());
+    if (found < 0) {
+      chain->end = CHAIN_ERROR;
+      return;
+    }
+    if (found == 0) {
+      chain->end = CHAIN_EOF;
+      return;
+    }
+    chain->start.push_back(start);
+    chain->bytes_to_check.push_back(bytes_to_check);
+    if (start >= end) {
+      chain->end = CHAIN_NEXT_SEGMENT;
+      return;
+    }
+  }
+}
+
+// Set up a locator so that its next call to rdi_next_ensemble() will
+// examine the ensemble that starts at 'start'.
+static void rdi_locator_at(MappedFile& mf, rdi_locator *loc, long long start, int quiet)
+{
+  loc->pos = start;
+  loc->bytes_to_check_last = 0;
+  loc->quiet = quiet;
+  loc->tail = 0;
+  loc->log = NULL;
+  loc->clast = rdi_getc(mf, loc);
+}
+
+// Scan the whole file using 'nthreads' threads, starting with the
+// locator state 'loc0'. The result is the chain that a serial scan
+// would find.
+static rdi_chain rdi_scan_parallel(MappedFile& mf, rdi_locator loc0, int nthreads, int debug_value)
+{
+  long long first = loc0.pos - 1;
+  int nseg = nthreads;
+  long long seglen = (mf.size() - first) / nseg + 1;
+  std::vector<rdi_chain> chains(nseg);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+  for (int k = 0; k < nseg; k++) {
+    long long a = first + k * seglen, b = a + seglen;
+    rdi_locator loc;
+    if (k == 0) {
+      loc = loc0;
+      loc.quiet = 1;
+    } else {
+      long long start = rdi_resync(mf, a);
+      if (start < 0) {
+        chains[k].end = CHAIN_EOF;
+        continue;
+      }
+      rdi_locator_at(mf, &loc, start, 1);
+    }
+    rdi_chain_extend(mf, &loc, b, &chains[k], 0);
+  }
+  rdi_chain res = chains[0];
+  int adopted = 1;
+  for (int k = 1; k < nseg && res.end == CHAIN_NEXT_SEGMENT; k++) {
+    long long last = res.start.back();
+    std::vector<long long>& s = chains[k].start;
+    std::vector<long long>::iterator it = std::lower_bound(s.begin(), s.end(), last);
+    if (it != s.end() && *it == last) {
+      size_t j = it - s.begin() + 1;
+      // Keep the messages from after the common ensemble, renumbered
+      // to suit the chain they are joining.
+      for (size_t i = 0; i < chains[k].message.size(); i++) {
+        if (chains[k].message_entry[i] >= j) {
+          res.message.push_back(chains[k].message[i]);
+          res.message_entry.push_back(chains[k].message_entry[i] - j + res.start.size());
+        }
+      }
+      res.start.insert(res.start.end(), s.begin() + j, s.end());
+      res.bytes_to_check.insert(res.bytes_to_check.end(),
+          chains[k].bytes_to_check.begin() + j, chains[k].bytes_to_check.end());
+      res.end = chains[k].end;
+      adopted++;
+    } else {
+      // The chains differ, so scan this segment serially, skipping
+      // the ensemble that we already have.
+      rdi_locator loc;
+      rdi_locator_at(mf, &loc, last, 0);
+      res.start.pop_back();
+      res.bytes_to_check.pop_back();
+      rdi_chain_extend(mf, &loc, first + (k + 1) * seglen, &res, debug_value);
+    }
+  }
+  if (debug_value > 0)
+    Rprintf("scanned %d segments with %d threads; adopted %d segment chains and scanned the rest serially\n",
+        nseg, nthreads, adopted);
+  return res;
+}
+
 // [[Rcpp::export]]
 List do_ldc_rdi_in_file(StringVector filename,
     IntegerVector from, IntegerVector to, IntegerVector by,
     IntegerVector startIndex,
     IntegerVector mode,
+    StringVector indexFile,
+    IntegerVector threads,
+    NumericVector cursor,
     IntegerVector debug)
 {
-  struct tm etime; // time of the ensemble under examination
   time_t ensemble_time = 0; // integer-ish form of the above (only calculated if mode=1)
   time_t ensemble_time_last = 0; // we use this for 'by', if mode is 1
+  if (filename.size() < 1)
+    ::Rf_error("must give at least one file name");
   std::string fn = Rcpp::as<std::string>(filename(0));
+  std::string index_name = Rcpp::as<std::string>(indexFile(0));
 
-  FILE *fp = fopen(fn.c_str(), "rb");
-  if (!fp)
-    ::Rf_error("cannot open file '%s'\n", fn.c_str());
+  MappedFile mf;
+  std::vector<std::string> fns(filename.size());
+  std::vector<const char *> fnp(filename.size());
+  for (int i = 0; i < filename.size(); i++) {
+    fns[i] = Rcpp::as<std::string>(filename(i));
+    fnp[i] = fns[i].c_str();
+  }
+  int open_failure = mf.open(&fnp[0], (int)fnp.size());
+  if (open_failure)
+    ::Rf_error("cannot open file '%s'\n", fnp[open_failure - 1]);
+  // An index describes one file, so it cannot be used for several.
+  if (mf.files() > 1)
+    index_name = "";
   if (from[0] < 0)
     ::Rf_error("'from' must be positive");
   unsigned long int from_value = from[0];
@@ -212,363 +755,347 @@ List do_ldc_rdi_in_file(StringVector filename,
   int mode_value = mode[0];
   if (mode_value != 0 && mode_value != 1)
     ::Rf_error("'mode' must be 0 or 1");
+  int nthreads = threads[0];
+  // A cursor means that the file may still be growing, so an index
+  // (which would go out of date) and multi-threaded scanning (which
+  // is pointless for short additions) are not used.
+  int follow = cursor.size() == 3;
+  if (cursor.size() != 0 && !follow)
+    ::Rf_error("'cursor' must be of length 0 or 3");
+  if (follow) {
+    if (ISNAN(cursor[0]) || cursor[0] < 0 || ISNAN(cursor[2]) || cursor[2] < 0)
+      ::Rf_error("'cursor' is not valid");
+    index_name = "";
+    nthreads = 1;
+  }
+#ifdef _OPENMP
+  if (nthreads < 1)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
   int debug_value = debug[0];
   if (debug_value < 0)
     debug_value = 0;
   if (debug_value > 0)
-    Rprintf("In C++ function named do_ldc_rdi_in_file: diagnostics will be printed because debug>0\n");
-  //Rprintf("from=%d, to=%d, by=%d, mode_value=%d\n", from_value, to_value, by_value, mode_value);
-  int c, clast=0x00;
-  int byte1 = 0x7f;
-  int byte2 = 0x7f;
-  //int byte2 = 0x79;
-  unsigned short int check_sum, desired_check_sum;
-  unsigned int bytes_to_check = 0;
-  unsigned int bytes_to_check_last = 0; // used to prevent freakouts if the chunk length is wrong (issue 1437)
-  unsigned long int cindex = 0;
-  unsigned long outEnsemblePointer = 1;
-  if (start_index > 1) {
+    Rprintf("In C++ function named do_ldc_rdi_in_file: diagnostics will be printed because debug>0 (file is %s)\n",
+        mf.mapped() ? "memory-mapped" : "read through a buffer");
+  rdi_locator loc;
+  loc.pos = 0;
+  loc.bytes_to_check_last = 0;
+  loc.quiet = 0;
+  loc.tail = follow;
+  loc.log = NULL;
+  if (follow) {
+    // Resume just after the last ensemble of the previous call, with
+    // the locator in the state it was in then.
+    loc.pos = (long long)cursor[0];
+    loc.bytes_to_check_last = (unsigned int)cursor[2];
+    if (debug_value > 0)
+      Rprintf("resuming scan at byte %lld (file size %lld)\n", loc.pos, mf.size());
+  } else if (start_index > 1) {
     Rprintf("In C++ function named ldc_rdi_in_file: skipping %d bytes at the start of the file, to get to 7F7F byte pair\n", start_index-1);
-    for (unsigned int i=1; i < start_index; i++) {
-      fgetc(fp);
-      cindex++;
-    }
+    loc.pos = start_index - 1;
   }
-  clast = fgetc(fp);
-  cindex++;
-  if (clast == EOF)
+  loc.clast = rdi_getc(mf, &loc);
+  if (loc.clast == EOF && !follow)
     ::Rf_error("empty file '%s'", fn.c_str());
-  // 'obuf' is a growable C buffer to hold the output, which eventually
-  // gets saved in the R item "buf".
-  unsigned long int nobuf = 100000; // BUFFER SIZE
-  unsigned char *obuf = (unsigned char *)R_Calloc((size_t)nobuf, unsigned char);
-  unsigned long int iobuf = 0;
+  long long outEnsemblePointer = 1;
 
   // 'ensembles', 'times' and 'sec100s' are growable buffers of equal length, with one
-  // element for each ensemble.  We also use 'ebuf', another growable buffer, for
-  // storage of data within the ensemble that is under consideration
-  // at the moment.
+  // element for each ensemble. The ensembles themselves are not copied
+  // until the scan is done, and then they go straight from the file
+  // into the R item "buf", which is allocated once, at the right size
+  // (found from 'outEnsemblePointer'). File offsets and positions in
+  // "buf" are long long values, since either may pass 4 GiB.
   //
   // Note that we do not check the Calloc() results because the R docs say that
   // Calloc() performs its won tests, and that R will handle any problems.
   unsigned long int nensembles = 100000; // BUFFER SIZE
-  unsigned int *ensemble_in_files = (unsigned int *)R_Calloc((size_t)nensembles, unsigned int);
-  int *ensembles = (int *)R_Calloc((size_t)nensembles, int);
+  // Size the buffers from the length of the first ensemble, and from
+  // 'from', 'to' and 'by', so that they need not grow, unless the
+  // ensembles vary in length. This is mostly for several files, which
+  // would otherwise be read in several calls, with the output built up
+  // piece by piece. The number of ensembles in a time window is not
+  // known, so for mode 1 the estimate is only allowed to lower the
+  // initial size, and the buffers grow (see below) if need be.
+  if (!follow && loc.clast != EOF) {
+    long long first = loc.pos - 1;
+    unsigned int btc = (unsigned int)mf.byte(first + 2) + 256 * (unsigned int)mf.byte(first + 3);
+    if (btc >= 5) {
+      unsigned long long estimate = (mf.size() - first) / (btc + 2) + 1;
+      if (mode_value == 0) {
+        if (from_value > 1)
+          estimate = estimate > from_value - 1 ? estimate - (from_value - 1) : 1;
+        if (to_value > 0 && to_value >= from_value && to_value - from_value + 1 < estimate)
+          estimate = to_value - from_value + 1;
+        if (by_value > 1)
+          estimate = estimate / by_value + 1;
+        nensembles = (unsigned long int)estimate + 16;
+      } else if (estimate + 16 < nensembles) {
+        nensembles = (unsigned long int)estimate + 16;
+      }
+    }
+  }
+  long long *offsets = (long long *)R_Calloc((size_t)nensembles, long long);
+  long long *ensembles = (long long *)R_Calloc((size_t)nensembles, long long);
   int *times = (int *)R_Calloc((size_t)nensembles, int);
   int *sec100s = (int *)R_Calloc((size_t)nensembles, int);
-  unsigned long int nebuf = 50000; // BUFFER SIZE
-  unsigned char *ebuf = (unsigned char *)R_Calloc((size_t)nebuf, unsigned char);
 
   unsigned long int in_ensemble = 1, out_ensemble = 0;
-  int b1, b2;
-
   unsigned long int counter = 0, counter_last = 0;
-  unsigned int long last7f7f = 0;
+  long long last7f7f = 0;
+  unsigned int bytes_to_check = 0;
+  int sec100_value = 0;
 
-  while (1) {
-    c = fgetc(fp);
-    cindex++;
-    if (c == EOF) {
-      Rprintf("Got to end of data while trying to read the first header byte of an RDI file (cindex=%d; last7f7f=%d)\n",
-              cindex, last7f7f);
-      break;
-    }
-    // Locate "ensemble starts", spots where a 0x7f is followed by a second 0x7f,
-    // then followed by data that match a checksum.
-    if (clast == byte1 && c == byte2) {
-      last7f7f = cindex - 2;
-      // The checksum includes the starting (0x7f, 0x7f) sequence, the
-      // two bytes that specify the number of bytes in the
-      // ensemble, and the data in the ensemble (sans the two bytes
-      // at the end of the data, which store the checksum).
+  // The place to resume, in a later call (see 'cursor' above).
+  long long cursor_pos = loc.pos - (loc.clast == EOF ? 0 : 1);
+  double cursor_count = follow ? cursor[1] : 0.0;
+  unsigned int cursor_bytes_to_check = loc.bytes_to_check_last;
+  if (follow)
+    in_ensemble = 1 + (ISNAN(cursor_count) ? 0 : (unsigned long int)cursor_count);
+
+  // If there is a valid index, we use it instead of scanning the file.
+  // Otherwise, if an index was requested, we build it as we scan, and
+  // carry on scanning to the end of the file after the 'to' condition
+  // is met, so that the index will be complete.
+  std::vector<rdi_index_entry> index;
+  int use_index = 0, build_index = 0, selection_done = 0, scan_error = 0;
+  size_t index_next = 0; // the next index entry to examine
+  if (index_name.size()) {
+    if (0 == rdi_index_read(index_name.c_str(), fn.c_str(), start_index, index)) {
+      use_index = 1;
       if (debug_value > 0)
-        Rprintf("0x7f 0x7f at position %d (cindex %d) last7f7f=%d\n", ftell(fp), cindex, last7f7f);
-      check_sum = (unsigned short int)byte1;
-      check_sum += (unsigned short int)byte2;
-      b1 = fgetc(fp);
-      cindex++;
-      if (b1 == EOF) {
-        Rprintf("Got to end of data while trying to read the 'b1' byte of an RDI file (cindex=%d; last7f7f=%d)\n", cindex, last7f7f);
-        break;
+        Rprintf("using %d-ensemble index file '%s'\n", (int)index.size(), index_name.c_str());
+    } else {
+      build_index = 1;
+      if (debug_value > 0)
+        Rprintf("will create index file '%s'\n", index_name.c_str());
+    }
+  }
+
+  // For time-based selection, skip quickly to the neighbourhood of the
+  // start of the window, instead of scanning from the start of the file.
+  // This is done before any multi-threaded scan, so that the same
+  // ensembles are examined (and the same damaged ones reported) for
+  // any number of threads.
+  if (mode_value == 1 && !use_index && !build_index && !follow && to_value >= from_value) {
+    long long seek = rdi_seek_time(mf, loc.pos - 1, (time_t)from_value, debug_value);
+    if (seek > loc.pos - 1) {
+      loc.pos = seek;
+      loc.clast = rdi_getc(mf, &loc);
+      cursor_count = NA_REAL;
+    }
+  }
+
+  // With several threads, scan the whole file in parallel (see
+  // rdi_scan_parallel()), and then proceed as if we had an index. The
+  // messages from the scan are printed as the ensembles are reached,
+  // or all of them, if an index is being built. This is only done if
+  // the rest of the file has to be scanned anyway, i.e. when building
+  // an index, or when the selection runs to the end of the file or is
+  // a time window (which starts near the place found by the bisection
+  // above), since a serial scan of a few ensembles near the start of
+  // a large file is much quicker.
+  std::vector<std::string> scan_message;
+  std::vector<size_t> scan_message_entry;
+  size_t message_next = 0;
+  int print_all_messages = 0;
+  if (!use_index && nthreads > 1 && mf.mapped() && mf.files() == 1
+      && (build_index || mode_value == 1 || to_value == 0)) {
+    rdi_chain chain = rdi_scan_parallel(mf, loc, nthreads, debug_value);
+    scan_message.swap(chain.message);
+    scan_message_entry.swap(chain.message_entry);
+    print_all_messages = build_index;
+    scan_error = chain.end == CHAIN_ERROR;
+    index.resize(chain.start.size());
+    for (size_t i = 0; i < index.size(); i++) {
+      index[i].start = chain.start[i];
+      index[i].bytes_to_check = chain.bytes_to_check[i];
+      index[i].ensemble_number = rdi_ensemble_number(mf, chain.start[i]);
+      index[i].time = (long long)rdi_ensemble_time(mf, chain.start[i], &index[i].sec100);
+    }
+    if (build_index && !scan_error)
+      rdi_index_save(index_name, fn, start_index, index, debug_value);
+    build_index = 0;
+    use_index = 1;
+  }
+
+  // Skip index entries that would not be selected anyway, provided
+  // that the 'to' condition cannot be met among them.
+  if (use_index) {
+    if (mode_value == 0) {
+      if (from_value > 2 && (to_value == 0 || to_value >= from_value - 1)) {
+        index_next = from_value - 2;
+        in_ensemble = from_value - 1;
+        if (index_next > index.size()) {
+          index_next = index.size();
+          in_ensemble = index_next + 1;
+        }
       }
-      check_sum += (unsigned short int)b1;
-      b2 = fgetc(fp);
-      cindex++;
-      if (b2 == EOF) {
-        Rprintf("Got to end of data while trying to read the 'b2' byte of an RDI file (cindex=%d; last7f7f=%d)\n", cindex, last7f7f);
+    } else if (to_value >= from_value) {
+      while (index_next < index.size() && index[index_next].time < (time_t)from_value)
+        index_next++;
+      in_ensemble = index_next + 1;
+    }
+  }
+
+  while (1) {
+    if (use_index) {
+      while (message_next < scan_message.size() && scan_message_entry[message_next] <= index_next)
+        Rprintf("%s", scan_message[message_next++].c_str());
+      if (index_next >= index.size()) {
+        if (scan_error) {
+          R_Free(ensembles);
+          R_Free(times);
+          R_Free(sec100s);
+          R_Free(offsets);
+          ::Rf_error("cannot decode the length of ensemble number %d", in_ensemble);
+        }
         break;
       }
-      check_sum += (unsigned short int)b2;
-      // Now we are ready to look at the rest of the bytes. Note that
-      // our loop starts at index 4, because we have already handled
-      // those 4 bytes of the ensemble (i.e. those 4 bytes are include
-      // in the bytes_to_check value that we now calculate).
-      bytes_to_check = (unsigned int)b1 + 256 * (unsigned int)b2;
-      if (debug_value > 0)
-        Rprintf("\nbytes_to_check=%d based on b1=%d(0x%02x) and b2=%d(0x%02x)\n", bytes_to_check, b1, b1, b2, b2);
-      if (bytes_to_check < 5) { // this will only happen in error; we check so bytes_to_read won't be crazy
+      last7f7f = index[index_next].start;
+      bytes_to_check = index[index_next].bytes_to_check;
+      ensemble_time = (time_t)index[index_next].time;
+      sec100_value = index[index_next].sec100;
+      index_next++;
+      cursor_count = (double)index_next;
+    } else {
+      int found = rdi_next_ensemble(mf, &loc, &last7f7f, &bytes_to_check, debug_value);
+      if (found < 0) {
         R_Free(ensembles);
         R_Free(times);
         R_Free(sec100s);
-        R_Free(ebuf);
+        R_Free(offsets);
         ::Rf_error("cannot decode the length of ensemble number %d", in_ensemble);
       }
-      if (bytes_to_check < 4)
-        ::Rf_error("bytes_to_check should be >=4 but it is %d\n", bytes_to_check);
-      unsigned int bytes_to_read = bytes_to_check - 4; // byte1&byte2&check_sum used 4 bytes already
-
-      // Expand the ensemble buffer, ebuf, if need be.
-      if (bytes_to_read > nebuf) {
-        if (debug_value > 0)
-          Rprintf("Increasing 'ebuf' buffer size from %d bytes to %d bytes\n", nebuf, bytes_to_read);
-        ebuf = (unsigned char *)R_Realloc(ebuf, bytes_to_read, unsigned char);
-        nebuf = bytes_to_read;
-      }
-      // Read the bytes in one operation, because fgetc() is too slow.
-      unsigned int bytesRead;
-      bytesRead = fread(ebuf, bytes_to_read, sizeof(unsigned char), fp);
-      if (feof(fp) || bytesRead == 0) {
-        Rprintf("Got to end of data while trying to read an RDI file (cindex=%d; last7f7f=%d)\n", cindex, last7f7f);
-        break;
-      }
-      cindex += bytes_to_read;
-      for (unsigned int ib = 0; ib < bytes_to_read; ib++) {
-        check_sum += (unsigned short int)ebuf[ib];
-      }
-      int cs1, cs2;
-      cs1 = fgetc(fp);
-      cindex++;
-      if (cs1 == EOF) {
-        Rprintf("Got to end of data while trying to get the first checksum byte in an RDI file (cindex=%d; last7f7f=%d)\n", cindex, last7f7f);
+      if (found == 0) {
+        if (build_index)
+          rdi_index_save(index_name, fn, start_index, index, debug_value);
         break;
       }
-      cs2 = fgetc(fp);
-      cindex++;
-      if (cs2 == EOF) {
-        Rprintf("Got to end of data while trying to get second checksum byte in an RDI file (cindex=%d; last7f7f=%d)\n", cindex, last7f7f);
-        break;
+      ensemble_time = rdi_ensemble_time(mf, last7f7f, &sec100_value);
+      cursor_count += 1.0; // NA stays NA
+      if (build_index) {
+        rdi_index_entry e;
+        e.start = last7f7f;
+        e.bytes_to_check = bytes_to_check;
+        e.ensemble_number = rdi_ensemble_number(mf, last7f7f);
+        e.time = (long long)ensemble_time;
+        e.sec100 = sec100_value;
+        index.push_back(e);
       }
-      desired_check_sum = ((unsigned short int)cs1) | ((unsigned short int)(cs2 << 8));
-      if (check_sum == desired_check_sum) {
-        if (debug_value > 0)
-          Rprintf("good checksum at cindex=%d (check_sum=%d desired_check_sum=%d bytes_to_read=%d last7f7f=%d)\n",
-              cindex, check_sum, desired_check_sum, bytes_to_read, last7f7f);
-        bytes_to_check_last = bytes_to_check; // use later, if find bad checksum (issue 1437)
-        // The check_sum is ok, so we may want to store the results for
-        // this profile.
-        //
-        // First, ensure that there will be sufficient storage to store results.
-        // We do this before checking to see if we are actually going
-        // to store the results, so possibly this might get done one
-        // more time than required, before this function returns.
-        if (out_ensemble >= nensembles) {
-          // Enlarge the buffer. We do not check the Realloc() result, because this
-          // is an R macro that is supposed to check for errors and handle them.
-          nensembles = 3 * nensembles / 2;
-          if (debug_value > -1)
-            Rprintf("Increasing ensembles,times,sec100s storage to %d elements ...\n", nensembles);
-          ensemble_in_files = (unsigned int *) R_Realloc(ensemble_in_files, nensembles, unsigned int);
-          ensembles = (int *) R_Realloc(ensembles, nensembles, int);
-          times = (int *) R_Realloc(times, nensembles, int);
-          sec100s = (int *)R_Realloc(sec100s, nensembles, int);
-        }
-        // We will decide whether to keep this ensemble, based on ensemble
-        // number, if mode_value==0 or on time, if mode_value==1. That
-        // means we only need to compute a time if mode_value==1.
-        unsigned int time_pointer = (unsigned int)ebuf[4] + 256 * (unsigned int) ebuf[5];
-        etime.tm_year = 100 + (int) ebuf[time_pointer+0];
-        etime.tm_mon = -1 + (int) ebuf[time_pointer+1];
-        etime.tm_mday = (int) ebuf[time_pointer+2];
-        etime.tm_hour = (int) ebuf[time_pointer+3];
-        etime.tm_min = (int) ebuf[time_pointer+4];
-        etime.tm_sec = (int) ebuf[time_pointer+5];
-        etime.tm_isdst = 0;
-        // Use local timegm code, which I suppose is risky, but it
-        // does not seem that Microsoft Windows provides this function
-        // in a workable form.
-        ensemble_time = oce_timegm(&etime);
-        // See whether we are past the 'from' condition. Note the "-1"
-        // for the ensemble case, because R starts counts at 1, not 0,
-        // and the calling R code is (naturally) in R notation.
-        if (debug_value > 0 && out_ensemble<OUTLIM)
-          Rprintf("  in_ensemble=%d; from_value=%d; counter=%d; counter_last=%d\n", in_ensemble, from_value, counter,  counter_last);
-        // Have we got to the starting location yet?
-        if ((mode_value == 0 && in_ensemble >= (from_value-1)) ||
-            (mode_value == 1 && ensemble_time >= (time_t)from_value)) {
-          //if (out_ensemble<OUTLIM) Rprintf("  STAGE 2 in_ensemble=%d; from_value=%d; counter=%d; counter_last=%d\n", in_ensemble, from_value, counter,  counter_last);
-          // Handle the 'by' value.
-          if ((mode_value == 0 && (counter==from_value-1 || (counter - counter_last) >= by_value)) ||
-              (mode_value == 1 && (ensemble_time - ensemble_time_last) >= (time_t)by_value)) {
-            //if (out_ensemble<OUTLIM) Rprintf("  STAGE 3 in_ensemble=%d; from_value=%d; counter=%d; counter_last=%d\n", in_ensemble, from_value, counter,  counter_last);
-            // Copy ensemble to output buffer, after 6 bytes of header
-            // FIXME: next is wrong. should have a cumsum
-            ensemble_in_files[out_ensemble] = 1 + last7f7f; // use R index-from-1 notation
-            ensembles[out_ensemble] = outEnsemblePointer;
-            outEnsemblePointer = outEnsemblePointer + 6 + bytes_to_read; // 6 bytes for: 0x7f,0x7f,b1,b2,cs1,cs2
-            times[out_ensemble] = ensemble_time;
-            // Increment counter (can be of two types)
-            if (mode_value == 1) {
-              ensemble_time_last = ensemble_time;
-            } else {
-              counter_last = counter;
-            }
-            //Rprintf("saving at in_ensemble=%d, counter=%d, by=%d\n", in_ensemble, counter, by_value);
-            //    ensembles[out_ensemble] = last_start;
-            unsigned int timePointer = (unsigned int)ebuf[4] + 256 * (unsigned int) ebuf[5];
-            sec100s[out_ensemble] = ebuf[timePointer+6];
-            out_ensemble++;
-            // Save to output buffer.
-            // {{{
-            if ((iobuf + 100 + bytes_to_read) >= nobuf) {
-              nobuf = nobuf + 100 + bytes_to_read + nobuf / 2;
-              if (debug_value > 0)
-                Rprintf("about to enlarge obuf storage to %d elements ...\n", nobuf);
-              obuf = (unsigned char *)R_Realloc(obuf, nobuf, unsigned char);
-              if (debug_value > 0)
-                Rprintf("    ... allocation was successful\n");
-            }
-            obuf[iobuf++] = byte1; // 0x7f
-            obuf[iobuf++] = byte2; // 0x7f
-            obuf[iobuf++] = b1; // length of ensemble, byte 1
-            obuf[iobuf++] = b2; // length of ensemble, byte 1
-            for (unsigned int i = 0; i < bytes_to_read; i++)
-              obuf[iobuf++] = ebuf[i]; // data, not including the checksum
-            obuf[iobuf++] = cs1; // checksum  byte 1
-            obuf[iobuf++] = cs2; // checksum  byte 2
-            // }}}
-          } else {
-            if (debug_value > 0)
-              Rprintf("Skipping at in_ensemble=%d, counter=%d, by=%d\n", in_ensemble, counter, by_value);
-          }
-          counter++;
-        }
-        in_ensemble++;
-        // If 'max' is positive, check that we return only that many
-        // ensemble pointers.
-        //> Rprintf("L417 in_ensemble=%d from_value=%d to_value=%d\n", in_ensemble, from_value, to_value);
-        if ((mode_value == 0 && (to_value > 0 && in_ensemble > to_value)) ||
-            (mode_value == 1 && (ensemble_time >= (time_t)to_value))) {
-          break;
+    }
+    cursor_pos = last7f7f + bytes_to_check + 2;
+    cursor_bytes_to_check = bytes_to_check;
+    if (selection_done)
+      continue;
+    unsigned int bytes_to_read = bytes_to_check - 4;
+    // The check_sum is ok, so we may want to store the results for
+    // this profile.
+    //
+    // First, ensure that there will be sufficient storage to store results.
+    // We do this before checking to see if we are actually going
+    // to store the results, so possibly this might get done one
+    // more time than required, before this function returns.
+    if (out_ensemble >= nensembles) {
+      // Enlarge the buffer. We do not check the Realloc() result, because this
+      // is an R macro that is supposed to check for errors and handle them.
+      nensembles = 3 * nensembles / 2;
+      if (debug_value > 0)
+        Rprintf("Increasing ensembles,times,sec100s storage to %d elements ...\n", nensembles);
+      offsets = (long long *) R_Realloc(offsets, nensembles, long long);
+      ensembles = (long long *) R_Realloc(ensembles, nensembles, long long);
+      times = (int *) R_Realloc(times, nensembles, int);
+      sec100s = (int *)R_Realloc(sec100s, nensembles, int);
+    }
+    // We will decide whether to keep this ensemble, based on ensemble
+    // number, if mode_value==0 or on time, if mode_value==1.
+    // See whether we are past the 'from' condition. Note the "-1"
+    // for the ensemble case, because R starts counts at 1, not 0,
+    // and the calling R code is (naturally) in R notation.
+    if (debug_value > 0 && out_ensemble<OUTLIM)
+      Rprintf("  in_ensemble=%d; from_value=%d; counter=%d; counter_last=%d\n", in_ensemble, from_value, counter,  counter_last);
+    // Have we got to the starting location yet?
+    if ((mode_value == 0 && in_ensemble >= (from_value-1)) ||
+        (mode_value == 1 && ensemble_time >= (time_t)from_value)) {
+      // Handle the 'by' value.
+      if ((mode_value == 0 && (counter==from_value-1 || (counter - counter_last) >= by_value)) ||
+          (mode_value == 1 && (ensemble_time - ensemble_time_last) >= (time_t)by_value)) {
+        // Note where the ensemble is, and where it will go in the
+        // output buffer.
+        offsets[out_ensemble] = last7f7f;
+        ensembles[out_ensemble] = outEnsemblePointer;
+        outEnsemblePointer = outEnsemblePointer + 6 + bytes_to_read; // 6 bytes for: 0x7f,0x7f,b1,b2,cs1,cs2
+        times[out_ensemble] = ensemble_time;
+        // Increment counter (can be of two types)
+        if (mode_value == 1) {
+          ensemble_time_last = ensemble_time;
+        } else {
+          counter_last = counter;
         }
+        sec100s[out_ensemble] = sec100_value;
+        out_ensemble++;
       } else {
-        cindex = ftell(fp); // synch up, just to be sure (cost is low since this rarely happens)
-        Rprintf("Warning: bad checksum at byte %d in file (check_sum=%d desired_check_sum=%d bytes_to_read=%d bytes_to_read_last=%d)\n", cindex, check_sum, desired_check_sum, bytes_to_read, bytes_to_check_last);
-        // maybe the number of bytes to check was wrong (issue 1437)
-        if (bytes_to_check_last != bytes_to_check) {
-          if (bytes_to_check == 0)
-            ::Rf_error("cannot read this file, because the first ensemble has a checksum error\n");
-          if (debug_value > 0)
-            Rprintf("the problem may be that length (%d bytes) disagrees with previous (%d bytes)\n", bytes_to_check, bytes_to_check_last);
-          // Skip to just past the last 7f7f, and then start looking
-          // for the next valid 7f7f.
-          cindex = last7f7f;
-          fseek(fp, last7f7f, SEEK_SET);
-          clast = 0;
-          for (unsigned int iii = 0; iii < 2 * bytes_to_check_last; iii++) {
-            c = fgetc(fp);
-            cindex++;
-            if (debug_value > 0)
-              Rprintf("realign iii=%d cindex=%d c=0x%02x clast=0x%02x\n", iii, cindex, c, clast);
-            if (clast==byte1 && c == byte2) {
-              if (debug_value > 0)
-                Rprintf(" got 7f 7f again at byte %d, after realigning. FYI bytes_to_check_last=%d\n", ftell(fp), bytes_to_check_last);
-              // check if next two bytes give the expected length as
-              // before
-              b1 = fgetc(fp);
-              cindex++;
-              b2 = fgetc(fp);
-              cindex++;
-              bytes_to_check = (unsigned int)b1 + 256 * (unsigned int)b2;
-              if (bytes_to_check == bytes_to_check_last) {
-                fseek(fp, -2L, SEEK_CUR);
-                cindex = ftell(fp); // synch up, just to be sure (cost is low since this rarely happens)
-                Rprintf("    ... recovered from bad checksum by restarting at byte %d in file\n", cindex);
-                break;
-              } else {
-                if (debug_value > 0)
-                  Rprintf(" ACCIDENTALLY MATCH since bytes_to_check=%d, not expected %d\n",bytes_to_check,bytes_to_check_last);
-              }
-            }
-            clast = c;
-          }
-          //Rprintf(" moving file pointer to %d\n", last7f7f + bytes_to_check_last + 1);
-          //Rprintf("  BEFORE, ftell() says at %d\n", ftell(fp));
-          //fseek(fp, last7f7f + bytes_to_check_last + 1, SEEK_SET); // FIXME: may need to add 2 or 4 bytes, or subtract
-          //cindex = last7f7f + bytes_to_check_last + 1;
-          //clast = 0; // FIXME: is this right?
-          //Rprintf("  AFTER, ftell() says at %d\n", ftell(fp));
-          //c = 0; // FIXME: is this right?
-        }
-
-        if (debug_value > 0 && out_ensemble < OUTLIM)
-          Rprintf("  in_ensemble=%d; from_value=%d; counter=%d; counter_last=%d\n", in_ensemble, from_value, counter,  counter_last);
-      }
-      R_CheckUserInterrupt(); // only check once per ensemble, for speed
-      //fseek(fp,-1L,SEEK_CUR);Rprintf("OK  test at %d c=0x%02x\n", ftell(fp), fgetc(fp));
-      clast = c;
-    } else {
-      // Either clast != byte1 or c != byte2) {
-      //Rprintf("skipping byte. c=0x%02x clast=0x%02x  cindex=%d (ftell() says at pointer %d)\n", c, clast, cindex, ftell(fp));
-      //fseek(fp,-1L,SEEK_CUR);Rprintf("BAD test at %d c=0x%02x\n", ftell(fp), fgetc(fp));
-      cindex = ftell(fp); // synch up, just to be sure (cost is low since this rarely happens)
-      Rprintf("Warning: bad ensemble-start byte-pair at byte %d in file\n", cindex);
-      if (debug_value > 0)
-        Rprintf("try skipping to get 0x7f 0x7f pair\n");
-      for (unsigned int iii = 0; iii < 2 * bytes_to_check_last; iii++) {
-        c = fgetc(fp);
-        cindex++;
         if (debug_value > 0)
-          Rprintf("skipping iii=%d cindex=%d c=0x%02x clast=0x%02x\n", iii, cindex, c, clast);
-        if (clast==byte1 && c == byte2) {
-          if (debug_value > 0)
-            Rprintf(" got 7f 7f again at byte %d, after skipping. FYI bytes_to_check_last=%d\n", ftell(fp), bytes_to_check_last);
-          Rprintf("    ... recovered from bad ensemble-start byte-pair by restarting at byte %d in file\n", cindex);
-          // adjust file pointer
-          fseek(fp, -2L, SEEK_CUR);
-          cindex = ftell(fp); // synch again, for code clarity (cost is low since this rarely happens)
-          break;
-        }
-        clast = c;
+          Rprintf("Skipping at in_ensemble=%d, counter=%d, by=%d\n", in_ensemble, counter, by_value);
       }
-      if (debug_value > 0)
-      Rprintf("====\n");
+      counter++;
+    }
+    in_ensemble++;
+    // If 'max' is positive, check that we return only that many
+    // ensemble pointers.
+    if ((mode_value == 0 && (to_value > 0 && in_ensemble > to_value)) ||
+        (mode_value == 1 && (ensemble_time >= (time_t)to_value))) {
+      if (!build_index)
+        break;
+      selection_done = 1;
     }
-    c = fgetc(fp);
-    cindex++;
-    clast = c;
-    if (c == EOF)
-      break;
   }
-  fclose(fp);
+  if (print_all_messages)
+    while (message_next < scan_message.size())
+      Rprintf("%s", scan_message[message_next++].c_str());
 
-  // Finally, copy into some R memory. Possibly we should have been
-  // using this all along, but I wasn't clear on how to reallocate it.
-  IntegerVector ensemble_in_file(out_ensemble);
-  IntegerVector ensemble(out_ensemble);
+  // Finally, copy into some R memory. The ensembles (0x7f, 0x7f, b1,
+  // b2, data, cs1, cs2) are copied straight from the file, so that the
+  // selection is held in memory only once.
+  // The offsets are returned as doubles, which hold integers exactly
+  // up to 2^53, so that files larger than 2 GiB can be read.
+  NumericVector ensemble_in_file(out_ensemble);
+  NumericVector ensemble(out_ensemble);
   IntegerVector sec100(out_ensemble);
   IntegerVector time(out_ensemble);
-  RawVector buf(iobuf);
+  RawVector buf = Rcpp::no_init(outEnsemblePointer - 1);
+  for (unsigned long int i = 0; i < out_ensemble; i++) {
+    long long len = (i + 1 < out_ensemble ? ensembles[i+1] : outEnsemblePointer) - ensembles[i];
+    const unsigned char *ensemble_bytes = mf.span(offsets[i], len);
+    if (!ensemble_bytes) {
+      long long offset = offsets[i];
+      R_Free(ensembles);
+      R_Free(times);
+      R_Free(sec100s);
+      R_Free(offsets);
+      ::Rf_error("cannot read ensemble at byte %lld of file '%s'", offset, fn.c_str());
+    }
+    memcpy(&buf[ensembles[i] - 1], ensemble_bytes, len);
+  }
+  mf.close();
 
   for (unsigned long int i = 0; i < out_ensemble; i++) {
-    ensemble_in_file[i] = ensemble_in_files[i];
-    ensemble[i] = ensembles[i];
+    ensemble_in_file[i] = (double)(1 + offsets[i]); // use R index-from-1 notation
+    ensemble[i] = (double)ensembles[i];
     time[i] = times[i];
     sec100[i] = sec100s[i];
-    //Rprintf("i=%d ensemble=%d time=%d sec100=%d\n", i, ensemble[i], time[i], (int)sec100[i]);
   }
-  R_Free(ensemble_in_files);
   R_Free(ensembles);
   R_Free(times);
   R_Free(sec100s);
-  R_Free(ebuf);
-  for (unsigned long int i = 0; i < iobuf; i++) {
-    buf[i] = obuf[i];
-  }
-  R_Free(obuf);
+  R_Free(offsets);
   if (debug_value > 0)
     Rprintf("Returning from C++ function named do_ldc_rdi_in_file.\n");
+  NumericVector new_cursor = NumericVector::create((double)cursor_pos, cursor_count,
+      (double)cursor_bytes_to_check);
   return(List::create(Named("ensembleStart")=ensemble, Named("time")=time,
         Named("sec100")=sec100, Named("buf")=buf,
-        Named("ensemble_in_file")=ensemble_in_file));
+        Named("ensemble_in_file")=ensemble_in_file, Named("cursor")=new_cursor));
 }
-
@@ -0,0 +1,275 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// See mapped_file.h for an explanation of what this does, and why.
+
+#include <stdlib.h>
+#include <string.h>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define oce_fseek _fseeki64
+#define oce_ftell _ftelli64
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define oce_fseek fseeko
+#define oce_ftell ftello
+#endif
+
+// Refills of the window (in the unmapped case) read at least this many
+// bytes, so that sequential scans need few fread() calls.
+#define WINDOW_MIN 4194304
+
+MappedFile::MappedFile()
+{
+  current = 0;
+  filesize = 0;
+  all_mapped = 0;
+  map = NULL;
+  window = NULL;
+  window_start = 0;
+  window_length = 0;
+  window_capacity = 0;
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+int MappedFile::open(const char *filename)
+{
+  return open(&filename, 1);
+}
+
+int MappedFile::open(const char *const *filenames, int n)
+{
+  close();
+  parts.resize(n);
+  all_mapped = 1;
+  for (int i = 0; i < n; i++) {
+    if (open_part(filenames[i], &parts[i])) {
+      parts.resize(i);
+      close();
+      return i + 1;
+    }
+    parts[i].start = filesize;
+    filesize += parts[i].size;
+    if (!parts[i].map && parts[i].size > 0)
+      all_mapped = 0;
+  }
+  if (n == 1)
+    map = parts[0].map;
+  return 0;
+}
+
+int MappedFile::open_part(const char *filename, part *p)
+{
+  p->start = 0;
+  p->size = 0;
+  p->map = NULL;
+  p->fp = NULL;
+#ifdef _WIN32
+  p->file_handle = NULL;
+  p->mapping_handle = NULL;
+  HANDLE fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fh != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER li;
+    if (GetFileSizeEx(fh, &li) && li.QuadPart > 0) {
+      HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mh) {
+        void *m = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+        if (m) {
+          p->size = li.QuadPart;
+          p->map = (const unsigned char *)m;
+          p->file_handle = (void *)fh;
+          p->mapping_handle = (void *)mh;
+          return 0;
+        }
+        CloseHandle(mh);
+      }
+    }
+    CloseHandle(fh);
+  }
+#else
+  int fd = ::open(filename, O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    if (0 == fstat(fd, &st) && st.st_size > 0 && (unsigned long long)st.st_size == (size_t)st.st_size) {
+      void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+        madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+        p->size = st.st_size;
+        p->map = (const unsigned char *)m;
+        ::close(fd); // the mapping holds its own reference
+        return 0;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+  // Cannot map the file, so fall back to reading it through a window.
+  p->fp = fopen(filename, "rb");
+  if (!p->fp)
+    return 1;
+  oce_fseek(p->fp, 0, SEEK_END);
+  p->size = oce_ftell(p->fp);
+  oce_fseek(p->fp, 0, SEEK_SET);
+  return 0;
+}
+
+void MappedFile::close_part(part *p)
+{
+  if (p->map) {
+#ifdef _WIN32
+    UnmapViewOfFile((LPCVOID)p->map);
+    CloseHandle((HANDLE)p->mapping_handle);
+    CloseHandle((HANDLE)p->file_handle);
+    p->mapping_handle = NULL;
+    p->file_handle = NULL;
+#else
+    munmap((void *)p->map, (size_t)p->size);
+#endif
+    p->map = NULL;
+  }
+  if (p->fp) {
+    fclose(p->fp);
+    p->fp = NULL;
+  }
+}
+
+void MappedFile::close()
+{
+  for (size_t i = 0; i < parts.size(); i++)
+    close_part(&parts[i]);
+  parts.clear();
+  current = 0;
+  map = NULL;
+  all_mapped = 0;
+  if (window) {
+    free(window);
+    window = NULL;
+  }
+  window_start = 0;
+  window_length = 0;
+  window_capacity = 0;
+  filesize = 0;
+}
+
+// Index of the part holding the byte at 'offset', which must lie
+// within the stream. Scans go forward through the stream, so the
+// part found last time is tried first. (Bisection finds the last part
+// that starts at or before 'offset', which cannot be an empty file,
+// since that would share its start with the next part.)
+size_t MappedFile::locate(long long offset)
+{
+  if (current < parts.size() && offset >= parts[current].start
+      && offset < parts[current].start + parts[current].size)
+    return current;
+  size_t lo = 0, hi = parts.size(); // bisect on the start offsets
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (parts[mid].start <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  current = lo;
+  return lo;
+}
+
+// Copy 'len' bytes, starting at stream offset 'offset', into 'dest',
+// going from one file to the next as needed, and return the number of
+// bytes copied.
+long long MappedFile::fill(unsigned char *dest, long long offset, long long len)
+{
+  long long done = 0;
+  for (size_t k = locate(offset); k < parts.size() && done < len; k++) {
+    part *p = &parts[k];
+    long long from = offset + done - p->start;
+    long long n = p->size - from;
+    if (n > len - done)
+      n = len - done;
+    if (n <= 0)
+      continue;
+    if (p->map) {
+      memcpy(dest + done, p->map + from, (size_t)n);
+    } else {
+      if (oce_fseek(p->fp, from, SEEK_SET))
+        break;
+      long long got = (long long)fread(dest + done, 1, (size_t)n, p->fp);
+      done += got;
+      if (got < n)
+        break;
+      continue;
+    }
+    done += n;
+  }
+  return done;
+}
+
+long long MappedFile::run(long long offset)
+{
+  if (offset < 0 || offset >= filesize)
+    return 0;
+  if (map || parts.size() == 1)
+    return filesize - offset;
+  part *p = &parts[locate(offset)];
+  return p->map ? p->start + p->size - offset : filesize - offset;
+}
+
+const unsigned char *MappedFile::span(long long offset, long long len)
+{
+  if (offset < 0 || len < 0 || offset + len > filesize)
+    return NULL;
+  if (map)
+    return map + offset;
+  if (parts.empty())
+    return NULL;
+  part *p = &parts[locate(offset)];
+  if (p->map && offset + len <= p->start + p->size)
+    return p->map + (offset - p->start);
+  if (offset >= window_start && offset + len <= window_start + window_length)
+    return window + (offset - window_start);
+  // Refill the window. If the bytes are all in mapped files, this is a
+  // join of the end of one file to the start of the next, and there is
+  // no point in copying more than was asked for.
+  long long want = len;
+  if (!all_mapped && want < WINDOW_MIN)
+    want = WINDOW_MIN;
+  if (want > filesize - offset)
+    want = filesize - offset;
+  if (want > window_capacity) {
+    unsigned char *w = (unsigned char *)realloc(window, (size_t)want);
+    if (!w)
+      return NULL;
+    window = w;
+    window_capacity = want;
+  }
+  window_start = offset;
+  window_length = fill(window, offset, want);
+  if (window_length < len)
+    return NULL;
+  return window;
+}
+
+long long find_byte_pair(const unsigned char *p, long long n, unsigned char b1, unsigned char b2)
+{
+  const unsigned char *start = p, *end = p + n;
+  while (end - p > 1) {
+    const unsigned char *q = (const unsigned char *)memchr(p, b1, (size_t)(end - p - 1));
+    if (!q)
+      return -1;
+    if (q[1] == b2)
+      return q - start;
+    p = q + 1;
+  }
+  return -1;
+}
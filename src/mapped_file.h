@@ -0,0 +1,103 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Read-only random access to a data file, for the binary locators.
+//
+// Where the operating system allows it, the whole file is mapped into
+// memory, so that the locators can look at (and checksum) bytes where
+// they sit in the page cache, without any fgetc()/fread() traffic.  If
+// mapping is impossible (e.g. on a platform without mmap(), or if the
+// address space is too small for the file), we fall back to reading
+// the file through a sliding window that is refilled with fread().
+// Callers do not need to know which scheme is in use, because all
+// access goes through span(), which returns a pointer to a run of
+// contiguous bytes.
+//
+// Several files may be opened together, e.g. the .000, .001, ... files
+// of a long RDI deployment, in which case they are treated as one
+// stream of bytes, with offsets running on from one file to the next.
+// Each file is mapped separately, and a span that crosses from one
+// file to the next is copied into the window, so records that were
+// split between files can still be read.
+//
+// Note that this file does not include any R headers, so it cannot
+// call Rf_error() and friends.  Problems are reported through return
+// values, and the calling code decides how to tell the user.
+
+#ifndef OCE_MAPPED_FILE_H
+#define OCE_MAPPED_FILE_H
+
+#include <stdio.h>
+#include <vector>
+
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+  // Open 'filename', returning 0 on success or nonzero on failure.
+  int open(const char *filename);
+  // Open 'n' files as one stream, returning 0 on success or the
+  // 1-based number of the first file that cannot be opened.
+  int open(const char *const *filenames, int n);
+  void close();
+  // Number of bytes in the file (or in all the files).
+  long long size() const { return filesize; }
+  // 1 if the file (or every file) is memory-mapped, 0 if any is being
+  // read through a window.
+  int mapped() const { return all_mapped; }
+  // Number of files that were opened.
+  int files() const { return (int)parts.size(); }
+  // Number of bytes, starting at 'offset', that span() can return
+  // without copying them, which is all the rest of the stream if it
+  // is a single file. This lets searches over long stretches proceed
+  // file by file.
+  long long run(long long offset);
+  // Pointer to 'len' bytes starting at 'offset', or NULL if the file
+  // does not hold that many bytes there. In the windowed case, or if
+  // the bytes run from one file to the next, the pointer is only valid
+  // until the next call to span(). Unless the stream is a single
+  // mapped file, span() is not thread-safe.
+  const unsigned char *span(long long offset, long long len);
+  // The byte at 'offset', or EOF if that is past the end of the file.
+  int byte(long long offset) {
+    if (offset < 0 || offset >= filesize)
+      return EOF;
+    if (map)
+      return map[offset];
+    const unsigned char *p = span(offset, 1);
+    return p ? *p : EOF;
+  }
+private:
+  MappedFile(const MappedFile&);            // not copyable
+  MappedFile& operator=(const MappedFile&); // not assignable
+  typedef struct {
+    long long start;         // stream offset of the first byte
+    long long size;          // number of bytes
+    const unsigned char *map; // whole file, if mapped
+    FILE *fp;                // used only in the windowed case
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+  } part;
+  int open_part(const char *filename, part *p);
+  void close_part(part *p);
+  size_t locate(long long offset);
+  long long fill(unsigned char *dest, long long offset, long long len);
+  std::vector<part> parts;
+  size_t current;            // part found by the last call to locate()
+  long long filesize;
+  int all_mapped;
+  const unsigned char *map;  // whole stream, if a single mapped file
+  unsigned char *window;     // used for windowed reading and joins
+  long long window_start;    // stream offset of window[0]
+  long long window_length;   // number of valid bytes in window
+  long long window_capacity; // allocated size of window
+};
+
+// Find the first 0x7f 0x7f byte pair (or, more generally, the first
+// instance of 'b1' followed by 'b2') in p[0:n-1], returning its index
+// or -1 if there is none.  This uses memchr(), which is vectorised in
+// the common C libraries, to skip quickly to candidate first bytes.
+long long find_byte_pair(const unsigned char *p, long long n, unsigned char b1, unsigned char b2);
+
+#endif
@@ -0,0 +1,409 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+#include <Rcpp.h>
+#include <string>
+#include <vector>
+#include <string.h>
+#include "civil_time.h"
+#include "compact_array.h"
+using namespace Rcpp;
+
+static inline int rdi_int16(const unsigned char *p)
+{
+  return (short)(p[0] | (p[1] << 8));
+}
+
+static inline int rdi_int32(const unsigned char *p)
+{
+  return (int)((unsigned int)p[0] | ((unsigned int)p[1] << 8)
+      | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24));
+}
+
+// Number of bytes in a VMDAS navigation chunk (code 0x00 0x20), as
+// described starting on p77 of VmDas_Users_Guide_May12.pdf.
+#define VMDAS_BYTES 92
+
+// Decode the data types within RDI ensembles, i.e. the work that was
+// formerly done by a loop in read.adp.rdi(), which was the main cost of
+// reading large files.
+//
+// Each ensemble has its own data-type table (the number of types in
+// byte 5, and a vector of 2-byte offsets starting at byte 6), and we
+// consult that table afresh for each ensemble, because files can have
+// interlaced data types; see
+// https://github.com/dankelley/oce/issues/1401
+//
+// Arguments:
+//   buf = buffer holding the ensembles, as returned by do_ldc_rdi_in_file()
+//   ensembleStart = 1-based indices of the ensembles in buf
+//   numberOfBeams, numberOfCells = dimensions of the profile arrays
+//   numberOfVCells = number of cells for the Sentinel V vertical beam
+//   found = integer vector indicating whether to set up storage for
+//     v, q, a, g, bottom-track, vv, vq, va, and vg, in that order. The
+//     caller works this out from the codes in the first ensemble.
+//   isSentinel = 1 if the instrument is a Sentinel V
+//
+// The return value is a list holding the arrays that read.adp.rdi()
+// used to build itself, with the same dimensions and the same
+// conventions for missing data (NA for numeric arrays and 0x00 for raw
+// arrays), plus some items ('unknownCode', 'stray' and 'endOfBuffer')
+// that let the R code issue the same warnings as before.
+//
+// Item 'vmdas' holds the VMDAS navigation data, with one element for
+// each navigation chunk. These used to be decoded by read.adp.rdi(),
+// which grew each of the 26 vectors with c(), an O(n^2) operation for
+// shipboard files that have a chunk in every ensemble. The times are
+// in seconds since 1970-01-01 UTC, and 'date' holds the UTC midnight
+// on which they are based, so that the caller can adjust to other
+// timezones.
+//
+// Cross-reference work:
+// 1. update ../src/registerDynamicSymbol.c with an item for this
+// 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
+//
+// [[Rcpp::export]]
+List do_rdi_decode_ensembles(RawVector buf, NumericVector ensembleStart,
+    IntegerVector numberOfBeams, IntegerVector numberOfCells,
+    IntegerVector numberOfVCells, IntegerVector found, IntegerVector isSentinel)
+{
+  if (found.size() != 9)
+    ::Rf_error("found must be of length 9, not %d\n", (int)found.size());
+  long long nbuf = buf.size();
+  const unsigned char *b = &buf[0];
+  // The array sizes, and the indices into them, can exceed the range
+  // of an int for long deployments, so they are R_xlen_t values.
+  R_xlen_t np = ensembleStart.size();
+  int nbeam = numberOfBeams[0];
+  int ncell = numberOfCells[0];
+  int nvcell = numberOfVCells[0];
+  int sentinel = isSentinel[0];
+  R_xlen_t items = (R_xlen_t)nbeam * ncell;
+  // Storage.  Note the R-style index order, [profile, cell, beam].
+  // Velocities are kept as 16-bit values (see compact_array.h), with
+  // scale factor 1e-3 for ensembles that hold them, and NA for others.
+  NumericVector br, bv, bq, ba, bg, vv;
+  RawVector q, a, g, vq, va, vg;
+  RObject v;
+  short *v16 = NULL;
+  double *vScale = NULL;
+  if (found[0]) {
+    v = oce_scaled_int16(np * items, np, -32768, &v16, &vScale);
+    v.attr("dim") = IntegerVector::create((int)np, ncell, nbeam);
+  }
+  if (found[1]) {
+    q = RawVector(np * items);
+    q.attr("dim") = IntegerVector::create((int)np, ncell, nbeam);
+  }
+  if (found[2]) {
+    a = RawVector(np * items);
+    a.attr("dim") = IntegerVector::create((int)np, ncell, nbeam);
+  }
+  if (found[3]) {
+    g = RawVector(np * items);
+    g.attr("dim") = IntegerVector::create((int)np, ncell, nbeam);
+  }
+  if (found[4]) {
+    br = NumericVector(np * nbeam, NA_REAL);
+    bv = NumericVector(np * nbeam, NA_REAL);
+    bq = NumericVector(np * nbeam, NA_REAL);
+    ba = NumericVector(np * nbeam, NA_REAL);
+    bg = NumericVector(np * nbeam, NA_REAL);
+    br.attr("dim") = IntegerVector::create((int)np, nbeam);
+    bv.attr("dim") = IntegerVector::create((int)np, nbeam);
+    bq.attr("dim") = IntegerVector::create((int)np, nbeam);
+    ba.attr("dim") = IntegerVector::create((int)np, nbeam);
+    bg.attr("dim") = IntegerVector::create((int)np, nbeam);
+  }
+  if (sentinel && found[5]) {
+    vv = NumericVector(np * nvcell, NA_REAL);
+    vv.attr("dim") = IntegerVector::create((int)np, nvcell);
+  }
+  if (sentinel && found[6]) {
+    vq = RawVector(np * nvcell);
+    vq.attr("dim") = IntegerVector::create((int)np, nvcell);
+  }
+  if (sentinel && found[7]) {
+    va = RawVector(np * nvcell);
+    va.attr("dim") = IntegerVector::create((int)np, nvcell);
+  }
+  if (sentinel && found[8]) {
+    vg = RawVector(np * nvcell);
+    vg.attr("dim") = IntegerVector::create((int)np, nvcell);
+  }
+  CharacterVector orientation(np);
+  NumericVector ensembleNumber(np);
+  std::vector<std::string> nmea;
+  // VMDAS navigation data, at most one chunk per ensemble. Few files
+  // have any, so the columns are allocated at the first chunk.
+  int nvmdas = 0;
+  NumericVector navDate, firstTime, lastTime;
+  NumericVector firstLatitude, firstLongitude, lastLatitude, lastLongitude;
+  NumericVector avgSpeed, speedMadeGood, directionMadeGood;
+  NumericVector shipPitch, shipRoll, shipHeading;
+  NumericVector speedMadeGoodNorth, speedMadeGoodEast;
+  IntegerVector avgTrackTrue, avgTrackMagnetic;
+  IntegerVector numberOfSpeedSamplesAveraged, numberOfTrueTrackSamplesAveraged;
+  IntegerVector numberOfMagneticTrackSamplesAveraged, numberOfHeadingSamplesAveraged;
+  IntegerVector numberOfPitchRollSamplesAveraged;
+  IntegerVector avgTrueVelocityNorth, avgTrueVelocityEast;
+  IntegerVector avgMagnitudeVelocityNorth, avgMagnitudeVelocityEast;
+  IntegerVector primaryFlags;
+  std::vector<std::string> unknownName;
+  std::vector<int> unknownCount;
+  std::vector<int> strayVCode, strayVProfile, strayBProfile;
+  std::vector<double> strayVOffset;
+  double endOfBuffer = NA_REAL;
+  for (int i = 0; i < np; i++) {
+    long long es = (long long)ensembleStart[i] - 1; // 0-based
+    if (es < 0 || es + 6 > nbuf)
+      ::Rf_error("ensembleStart[%d]=%.0f is outside the buffer\n", i+1, ensembleStart[i]);
+    int ndt = (signed char)b[es + 5];
+    if (es + 6 + 2 * (long long)ndt > nbuf)
+      ::Rf_error("data-type table of ensemble %d runs past the end of the buffer\n", i+1);
+    long long o = 0;
+    for (int chunk = 0; chunk < ndt; chunk++) {
+      short dataOffset = (short)(b[es + 6 + 2*chunk] | (b[es + 7 + 2*chunk] << 8));
+      o = es + dataOffset; // 0-based, so buf[o+1] in R notation
+      if (o < 0 || o + 2 > nbuf)
+        break;
+      unsigned char c0 = b[o], c1 = b[o + 1];
+      const unsigned char *p = b + o;
+      long long room = nbuf - o; // bytes available at p
+      if (c0 == 0x00 && c1 == 0x00) {
+        if (room > 4)
+          orientation[i] = (p[4] & 0x80) ? "upward" : "downward";
+      } else if (c0 == 0x80 && c1 == 0x00) {
+        if (room > 11)
+          ensembleNumber[i] = (short)(p[2] | (p[3] << 8)) + 65535.0 * p[11];
+      } else if (c0 == 0x00 && c1 == 0x01) {
+        if (found[0] && room >= 2 + 2 * (long long)items) {
+          // The file stores beams fastest, then cells.
+          vScale[i] = 1e-3;
+          for (int cell = 0; cell < ncell; cell++) {
+            for (int beam = 0; beam < nbeam; beam++) {
+              int k = 2 + 2 * (cell * nbeam + beam);
+              v16[i + np * (cell + ncell * beam)] = (short)(p[k] | (p[k+1] << 8));
+            }
+          }
+        }
+      } else if (c0 == 0x00 && (c1 == 0x02 || c1 == 0x03 || c1 == 0x04)) {
+        int which = c1 - 0x02 + 1; // 1=q, 2=a, 3=g
+        if (found[which] && room >= 2 + (long long)items) {
+          RawVector &dest = which == 1 ? q : (which == 2 ? a : g);
+          for (int cell = 0; cell < ncell; cell++)
+            for (int beam = 0; beam < nbeam; beam++)
+              dest[i + np * (cell + ncell * beam)] = p[2 + cell * nbeam + beam];
+        }
+      } else if (c0 == 0x00 && c1 == 0x05) {
+        ; // FIXME: do something here (what is code 0x00 0x05?)
+      } else if (c0 == 0x00 && c1 == 0x06) {
+        if (!found[4]) {
+          strayBProfile.push_back(i + 1);
+        } else if (room > 80) {
+          for (int beam = 0; beam < nbeam && beam < 4; beam++) {
+            unsigned int rangeLSB = p[16 + 2*beam] | (p[17 + 2*beam] << 8);
+            unsigned int rangeMSB = p[77 + beam];
+            br[i + np * beam] = 0.01 * (65536.0 * rangeMSB + rangeLSB);
+            bv[i + np * beam] = 0.001 * (short)(p[24 + 2*beam] | (p[25 + 2*beam] << 8));
+            bq[i + np * beam] = p[32 + beam];
+            ba[i + np * beam] = p[36 + beam];
+            bg[i + np * beam] = p[40 + beam];
+          }
+        }
+      } else if (c0 == 0x00 && c1 == 0x20) {
+        if (nvmdas == 0) {
+          navDate = NumericVector(np); firstTime = NumericVector(np); lastTime = NumericVector(np);
+          firstLatitude = NumericVector(np); firstLongitude = NumericVector(np);
+          lastLatitude = NumericVector(np); lastLongitude = NumericVector(np);
+          avgSpeed = NumericVector(np); speedMadeGood = NumericVector(np);
+          directionMadeGood = NumericVector(np);
+          shipPitch = NumericVector(np); shipRoll = NumericVector(np); shipHeading = NumericVector(np);
+          speedMadeGoodNorth = NumericVector(np); speedMadeGoodEast = NumericVector(np);
+          avgTrackTrue = IntegerVector(np); avgTrackMagnetic = IntegerVector(np);
+          numberOfSpeedSamplesAveraged = IntegerVector(np);
+          numberOfTrueTrackSamplesAveraged = IntegerVector(np);
+          numberOfMagneticTrackSamplesAveraged = IntegerVector(np);
+          numberOfHeadingSamplesAveraged = IntegerVector(np);
+          numberOfPitchRollSamplesAveraged = IntegerVector(np);
+          avgTrueVelocityNorth = IntegerVector(np); avgTrueVelocityEast = IntegerVector(np);
+          avgMagnitudeVelocityNorth = IntegerVector(np); avgMagnitudeVelocityEast = IntegerVector(np);
+          primaryFlags = IntegerVector(np);
+        }
+        if (nvmdas < np) {
+          int k = nvmdas++;
+          if (room < VMDAS_BYTES) {
+            navDate[k] = firstTime[k] = lastTime[k] = NA_REAL;
+            firstLatitude[k] = firstLongitude[k] = lastLatitude[k] = lastLongitude[k] = NA_REAL;
+            avgSpeed[k] = speedMadeGood[k] = directionMadeGood[k] = NA_REAL;
+            shipPitch[k] = shipRoll[k] = shipHeading[k] = NA_REAL;
+            speedMadeGoodNorth[k] = speedMadeGoodEast[k] = NA_REAL;
+            avgTrackTrue[k] = avgTrackMagnetic[k] = NA_INTEGER;
+            numberOfSpeedSamplesAveraged[k] = numberOfTrueTrackSamplesAveraged[k] = NA_INTEGER;
+            numberOfMagneticTrackSamplesAveraged[k] = numberOfHeadingSamplesAveraged[k] = NA_INTEGER;
+            numberOfPitchRollSamplesAveraged[k] = NA_INTEGER;
+            avgTrueVelocityNorth[k] = avgTrueVelocityEast[k] = NA_INTEGER;
+            avgMagnitudeVelocityNorth[k] = avgMagnitudeVelocityEast[k] = NA_INTEGER;
+            primaryFlags[k] = NA_INTEGER;
+          } else {
+            // The date is binary (not BCD), with a 2-byte year; the
+            // times within it are in units of 1e-4 s, to which is added
+            // the PC clock offset, in ms.
+            double date = oce_civil_to_seconds(p[4] + 256 * p[5], p[3], p[2], 0, 0, 0);
+            double clockOffset = 0.001 * rdi_int32(p + 10);
+            const double cfac = 180.0 / 2147483648.0; // from rdradcp.m line 825
+            const double afac = 360.0 / 65536.0;
+            navDate[k] = ISNAN(date) ? NA_REAL : date;
+            firstTime[k] = navDate[k] + clockOffset + rdi_int32(p + 6) / 10000.0;
+            firstLatitude[k] = cfac * rdi_int32(p + 14);
+            firstLongitude[k] = cfac * rdi_int32(p + 18);
+            lastTime[k] = navDate[k] + clockOffset + rdi_int32(p + 22) / 10000.0;
+            lastLatitude[k] = cfac * rdi_int32(p + 26);
+            lastLongitude[k] = cfac * rdi_int32(p + 30);
+            avgSpeed[k] = 0.001 * rdi_int16(p + 34);
+            avgTrackTrue[k] = rdi_int16(p + 36);
+            avgTrackMagnetic[k] = rdi_int16(p + 38);
+            speedMadeGood[k] = 0.001 * rdi_int16(p + 40);
+            directionMadeGood[k] = afac * rdi_int16(p + 42);
+            shipPitch[k] = afac * rdi_int16(p + 62);
+            shipRoll[k] = afac * rdi_int16(p + 64);
+            shipHeading[k] = afac * rdi_int16(p + 66);
+            numberOfSpeedSamplesAveraged[k] = rdi_int16(p + 68);
+            numberOfTrueTrackSamplesAveraged[k] = rdi_int16(p + 70);
+            numberOfMagneticTrackSamplesAveraged[k] = rdi_int16(p + 72);
+            numberOfHeadingSamplesAveraged[k] = rdi_int16(p + 74);
+            numberOfPitchRollSamplesAveraged[k] = rdi_int16(p + 76);
+            avgTrueVelocityNorth[k] = rdi_int16(p + 78);
+            avgTrueVelocityEast[k] = rdi_int16(p + 80);
+            avgMagnitudeVelocityNorth[k] = rdi_int16(p + 82);
+            avgMagnitudeVelocityEast[k] = rdi_int16(p + 84);
+            speedMadeGoodNorth[k] = 0.001 * rdi_int16(p + 86);
+            speedMadeGoodEast[k] = 0.001 * rdi_int16(p + 88);
+            primaryFlags[k] = rdi_int16(p + 90);
+          }
+        }
+      } else if (c0 == 0x00 && (c1 == 0x0a || c1 == 0x0b || c1 == 0x0c || c1 == 0x0d)) {
+        // Sentinel V vertical beam
+        if (!sentinel) {
+          strayVCode.push_back(c1);
+          strayVOffset.push_back((double)(o + 1));
+          strayVProfile.push_back(i + 1);
+        } else if (c1 == 0x0a) {
+          if (found[5] && room >= 2 + 2 * (long long)nvcell) {
+            for (int cell = 0; cell < nvcell; cell++) {
+              short s = (short)(p[2 + 2*cell] | (p[3 + 2*cell] << 8));
+              vv[i + np * cell] = s == -32768 ? NA_REAL : 1e-3 * s;
+            }
+          }
+        } else {
+          int which = c1 - 0x0b + 6; // 6=vq, 7=va, 8=vg
+          if (found[which] && room >= 2 + (long long)nvcell) {
+            RawVector &dest = which == 6 ? vq : (which == 7 ? va : vg);
+            for (int cell = 0; cell < nvcell; cell++)
+              dest[i + np * cell] = p[2 + cell];
+          }
+        }
+      } else if (c1 == 0x21 && c0 <= 0x03) {
+        // NMEA strings; lengths from table 5 of [WinRiver User Guide
+        // International Verion.pdf.pdf].  As in nmea_len() in bitwise.c,
+        // the string ends at the first CR-LF pair.
+        static const int nmeaLength[4] = {36, 92, 43, 36};
+        int nb = nmeaLength[c0];
+        if (room >= 2 + nb) {
+          const char *s = (const char *)(p + 2);
+          int end = nb - 2;
+          for (int k = 0; k < nb - 1; k++) {
+            if (s[k] == '\r' && s[k+1] == '\n') {
+              end = k;
+              break;
+            }
+          }
+          std::string str(s, strnlen(s, end));
+          if (str.size())
+            nmea.push_back(str);
+        }
+      } else if (c0 == 0x00 && c1 == 0x30) {
+        ; // already handled by the caller
+      } else {
+        char key[20];
+        snprintf(key, 20, "0x%02x 0x%02x", c0, c1);
+        size_t k;
+        for (k = 0; k < unknownName.size(); k++)
+          if (unknownName[k] == key)
+            break;
+        if (k == unknownName.size()) {
+          unknownName.push_back(key);
+          unknownCount.push_back(0);
+        }
+        unknownCount[k]++;
+      }
+    }
+    if (o + 1 >= nbuf) {
+      endOfBuffer = (double)(o + 1);
+      break;
+    }
+  }
+  IntegerVector unknownCode(unknownCount.begin(), unknownCount.end());
+  if (unknownName.size())
+    unknownCode.attr("names") = CharacterVector(unknownName.begin(), unknownName.end());
+  List vmdas;
+  if (nvmdas > 0) {
+    // Names are in the order that read.adp.rdi() stores them. (This is
+    // too many for List::create().)
+    const char *vmdasName[] = {"date", "avgSpeed",
+      "avgMagnitudeVelocityEast", "avgMagnitudeVelocityNorth",
+      "avgTrackMagnetic", "avgTrackTrue",
+      "avgTrueVelocityEast", "avgTrueVelocityNorth",
+      "directionMadeGood", "firstLatitude", "firstLongitude", "firstTime",
+      "lastLatitude", "lastLongitude", "lastTime",
+      "numberOfHeadingSamplesAveraged", "numberOfMagneticTrackSamplesAveraged",
+      "numberOfPitchRollSamplesAveraged", "numberOfSpeedSamplesAveraged",
+      "numberOfTrueTrackSamplesAveraged", "primaryFlags",
+      "shipHeading", "shipPitch", "shipRoll",
+      "speedMadeGood", "speedMadeGoodEast", "speedMadeGoodNorth"};
+    SEXP vmdasColumn[] = {navDate, avgSpeed,
+      avgMagnitudeVelocityEast, avgMagnitudeVelocityNorth,
+      avgTrackMagnetic, avgTrackTrue,
+      avgTrueVelocityEast, avgTrueVelocityNorth,
+      directionMadeGood, firstLatitude, firstLongitude, firstTime,
+      lastLatitude, lastLongitude, lastTime,
+      numberOfHeadingSamplesAveraged, numberOfMagneticTrackSamplesAveraged,
+      numberOfPitchRollSamplesAveraged, numberOfSpeedSamplesAveraged,
+      numberOfTrueTrackSamplesAveraged, primaryFlags,
+      shipHeading, shipPitch, shipRoll,
+      speedMadeGood, speedMadeGoodEast, speedMadeGoodNorth};
+    int ncolumn = sizeof(vmdasColumn) / sizeof(vmdasColumn[0]);
+    vmdas = List(ncolumn);
+    CharacterVector names(ncolumn);
+    for (int k = 0; k < ncolumn; k++) {
+      // Shorten the columns if some ensembles lacked navigation data.
+      vmdas[k] = nvmdas == np ? vmdasColumn[k] : ::Rf_lengthgets(vmdasColumn[k], nvmdas);
+      names[k] = vmdasName[k];
+    }
+    vmdas.attr("names") = names;
+  }
+  return List::create(
+      Named("v") = found[0] ? (SEXP)v : R_NilValue,
+      Named("q") = found[1] ? (SEXP)q : R_NilValue,
+      Named("a") = found[2] ? (SEXP)a : R_NilValue,
+      Named("g") = found[3] ? (SEXP)g : R_NilValue,
+      Named("br") = found[4] ? (SEXP)br : R_NilValue,
+      Named("bv") = found[4] ? (SEXP)bv : R_NilValue,
+      Named("bq") = found[4] ? (SEXP)bq : R_NilValue,
+      Named("ba") = found[4] ? (SEXP)ba : R_NilValue,
+      Named("bg") = found[4] ? (SEXP)bg : R_NilValue,
+      Named("vv") = sentinel && found[5] ? (SEXP)vv : R_NilValue,
+      Named("vq") = sentinel && found[6] ? (SEXP)vq : R_NilValue,
+      Named("va") = sentinel && found[7] ? (SEXP)va : R_NilValue,
+      Named("vg") = sentinel && found[8] ? (SEXP)vg : R_NilValue,
+      Named("orientation") = orientation,
+      Named("ensembleNumber") = ensembleNumber,
+      Named("nmea") = nmea.size() ? (SEXP)CharacterVector(nmea.begin(), nmea.end()) : R_NilValue,
+      Named("vmdas") = nvmdas > 0 ? (SEXP)vmdas : R_NilValue,
+      Named("unknownCode") = unknownCode,
+      Named("stray") = List::create(
+          Named("verticalCode") = IntegerVector(strayVCode.begin(), strayVCode.end()),
+          Named("verticalOffset") = NumericVector(strayVOffset.begin(), strayVOffset.end()),
+          Named("verticalProfile") = IntegerVector(strayVProfile.begin(), strayVProfile.end()),
+          Named("bottomTrackProfile") = IntegerVector(strayBProfile.begin(), strayBProfile.end())),
+      Named("endOfBuffer") = endOfBuffer);
+}
@@ -0,0 +1,142 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// See rdi_index.h for an explanation of what this does, and why.
+//
+// File layout. All numbers are little-endian, regardless of the
+// platform, so that an index can be shared between machines.
+//
+//   bytes  contents
+//   0-7    "OCEIDX1\n"
+//   8-15   size of the data file, in bytes
+//   16-23  modification time of the data file (seconds since 1970)
+//   24-31  startIndex, as given to do_ldc_rdi_in_file()
+//   32-39  number of entries
+//   40-    entries, each of RECORD bytes, holding start (8 bytes),
+//          bytes_to_check (4), ensemble_number (4), time (8) and
+//          sec100 (4)
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "rdi_index.h"
+
+#define MAGIC "OCEIDX1\n"
+#define HEADER 40
+#define RECORD 28
+
+static int data_file_signature(const char *data_name, long long *size, long long *mtime)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(data_name, &st))
+    return 1;
+#else
+  struct stat st;
+  if (stat(data_name, &st))
+    return 1;
+#endif
+  *size = (long long)st.st_size;
+  *mtime = (long long)st.st_mtime;
+  return 0;
+}
+
+static void put_le(unsigned char *p, unsigned long long value, int n)
+{
+  for (int i = 0; i < n; i++) {
+    p[i] = (unsigned char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+static unsigned long long get_le(const unsigned char *p, int n)
+{
+  unsigned long long value = 0;
+  for (int i = n - 1; i >= 0; i--)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+int rdi_index_read(const char *index_name, const char *data_name,
+    long long start_index, std::vector<rdi_index_entry>& entries)
+{
+  long long size, mtime;
+  if (data_file_signature(data_name, &size, &mtime))
+    return 1;
+  FILE *fp = fopen(index_name, "rb");
+  if (!fp)
+    return 1;
+  unsigned char header[HEADER];
+  if (HEADER != fread(header, 1, HEADER, fp)
+      || memcmp(header, MAGIC, 8)
+      || (long long)get_le(header + 8, 8) != size
+      || (long long)get_le(header + 16, 8) != mtime
+      || (long long)get_le(header + 24, 8) != start_index) {
+    fclose(fp);
+    return 1;
+  }
+  unsigned long long n = get_le(header + 32, 8);
+  if (n > (unsigned long long)size / 5) { // each ensemble takes at least 5 bytes
+    fclose(fp);
+    return 1;
+  }
+  entries.resize((size_t)n);
+  unsigned char record[RECORD];
+  for (unsigned long long i = 0; i < n; i++) {
+    if (RECORD != fread(record, 1, RECORD, fp)) {
+      fclose(fp);
+      entries.clear();
+      return 1;
+    }
+    entries[i].start = (long long)get_le(record, 8);
+    entries[i].bytes_to_check = (unsigned int)get_le(record + 8, 4);
+    entries[i].ensemble_number = (unsigned int)get_le(record + 12, 4);
+    entries[i].time = (long long)get_le(record + 16, 8);
+    entries[i].sec100 = (int)get_le(record + 24, 4);
+    if (entries[i].start < 0 || entries[i].start + entries[i].bytes_to_check + 2 > size) {
+      fclose(fp);
+      entries.clear();
+      return 1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+int rdi_index_write(const char *index_name, const char *data_name,
+    long long start_index, const std::vector<rdi_index_entry>& entries)
+{
+  long long size, mtime;
+  if (data_file_signature(data_name, &size, &mtime))
+    return 1;
+  std::string tmp_name = std::string(index_name) + ".tmp";
+  FILE *fp = fopen(tmp_name.c_str(), "wb");
+  if (!fp)
+    return 1;
+  unsigned char header[HEADER];
+  memcpy(header, MAGIC, 8);
+  put_le(header + 8, (unsigned long long)size, 8);
+  put_le(header + 16, (unsigned long long)mtime, 8);
+  put_le(header + 24, (unsigned long long)start_index, 8);
+  put_le(header + 32, (unsigned long long)entries.size(), 8);
+  int bad = HEADER != fwrite(header, 1, HEADER, fp);
+  unsigned char record[RECORD];
+  for (size_t i = 0; !bad && i < entries.size(); i++) {
+    put_le(record, (unsigned long long)entries[i].start, 8);
+    put_le(record + 8, entries[i].bytes_to_check, 4);
+    put_le(record + 12, entries[i].ensemble_number, 4);
+    put_le(record + 16, (unsigned long long)entries[i].time, 8);
+    put_le(record + 24, (unsigned long long)(unsigned int)entries[i].sec100, 4);
+    bad = RECORD != fwrite(record, 1, RECORD, fp);
+  }
+  if (fclose(fp))
+    bad = 1;
+  if (!bad) {
+    remove(index_name); // rename() will not replace a file on Windows
+    bad = rename(tmp_name.c_str(), index_name);
+  }
+  if (bad)
+    remove(tmp_name.c_str());
+  return bad;
+}
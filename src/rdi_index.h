@@ -0,0 +1,46 @@
+/* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
+
+// Index ("sidecar") files for RDI data files.
+//
+// Locating ensembles in an RDI file requires a scan from the start of
+// the file, because ensembles have varying lengths, and because
+// damaged ensembles must be skipped. For a large file, that is a lot
+// of work to repeat if the file is read in pieces, e.g. when paging
+// through a deployment. An index file, named by appending ".oceidx" to
+// the data-file name, records the result of a full scan, so that
+// later reads can go straight to the ensembles they need.
+//
+// The index holds the size and modification time of the data file,
+// and it is ignored if either of these has changed. It also holds the
+// location of the first 0x7f 0x7f byte pair (the 'startIndex' argument
+// of do_ldc_rdi_in_file()), since the scan depends on that.
+//
+// Like mapped_file.h, this file does not include any R headers, and
+// problems are reported through return values.
+
+#ifndef OCE_RDI_INDEX_H
+#define OCE_RDI_INDEX_H
+
+#include <vector>
+
+typedef struct {
+  long long start;              // file offset of the 0x7f 0x7f byte pair
+  unsigned int bytes_to_check;  // bytes in the ensemble, sans checksum
+  unsigned int ensemble_number; // from the variable leader
+  long long time;               // seconds since 1970-01-01 UTC
+  int sec100;                   // hundredths of a second
+} rdi_index_entry;
+
+// Read an index, returning 0 on success, or nonzero if the index does
+// not exist, cannot be read, or does not match the data file.
+int rdi_index_read(const char *index_name, const char *data_name,
+    long long start_index, std::vector<rdi_index_entry>& entries);
+
+// Write an index, returning 0 on success, or nonzero on failure (e.g.
+// if the directory is not writable). The file is written under a
+// temporary name and then renamed, so that other processes never see
+// a partial index.
+int rdi_index_write(const char *index_name, const char *data_name,
+    long long start_index, const std::vector<rdi_index_entry>& entries);
+
+#endif
@@ -1,145 +1,262 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
 
+// Locating and decoding the profiles of SonTek ADP files.
+//
+// Each profile holds (ref 1, A3 "Profile Header/CTD/GPS/Bottom
+// Track/SonWave/Profile Data Structures")
+//   bytes  contents
+//   80     header, starting 0xA5 0x10 0x50 (80, the header length)
+//   36     extra header, for PCADP instruments only (ref 2)
+//   16     CTD data, if a CTD was attached
+//   40     GPS data, if a GPS was attached
+//   18     bottom-track data, if bottom tracking was on
+//   2*n    velocities (signed 16-bit, mm/s), for n=ncell*nbeam
+//   n      velocity standard deviations
+//   n      amplitudes
+//   2      checksum, the sum of the bytes above, plus 0xA596
+// The profile header does not say which of the optional blocks are
+// present, so each candidate profile is checked against each of the
+// eight possible layouts, starting with that of the previous profile,
+// until the checksum matches.  The number of cells and beams are
+// taken from each profile's header, so they may vary through a file.
+//
+// REFERENCES
+//   1. see ADPManual_710.pdf, logical pages 82-86.
+//   2. hydratools20apr06/adp2cdf.m line 1360 re PCADP's extra header.
+
 #include <Rcpp.h>
+#include <string.h>
+#include <vector>
+#include "checksum.h"
 using namespace Rcpp;
 
+#define HEADER_LENGTH 80
+#define MAX_BEAMS 4
+#define PCADP_EXTRA_LENGTH (2*(8+MAX_BEAMS) + 2*MAX_BEAMS + MAX_BEAMS)
+#define CTD_LENGTH 16
+#define GPS_LENGTH 40
+#define BOTTOM_TRACK_LENGTH 18
+// Bits of the 'layout' code of a profile.
+#define HAVE_CTD 1
+#define HAVE_GPS 2
+#define HAVE_BOTTOM_TRACK 4
+
+static int sontek_adp_blocks_length(int layout)
+{
+  return ((layout & HAVE_CTD) ? CTD_LENGTH : 0)
+    + ((layout & HAVE_GPS) ? GPS_LENGTH : 0)
+    + ((layout & HAVE_BOTTOM_TRACK) ? BOTTOM_TRACK_LENGTH : 0);
+}
+
+static int sontek_adp_nbeam(const unsigned char *p)
+{
+  return (int)p[26];
+}
+
+static int sontek_adp_ncell(const unsigned char *p)
+{
+  return ((unsigned short)p[30]) | ((unsigned short)p[31] << 8);
+}
+
 // Cross-reference work:
 // 1. update ../src/registerDynamicSymbol.c with an item for this
 // 2. main code should use the autogenerated wrapper in ../R/RcppExports.R
 //
 // [[Rcpp::export]]
-IntegerVector do_ldc_sontek_adp(RawVector buf, IntegerVector have_ctd, IntegerVector have_gps, IntegerVector have_bottom_track, IntegerVector pcadp, IntegerVector max)
+List do_ldc_sontek_adp(RawVector buf, IntegerVector pcadp, IntegerVector max)
 {
-  /*
-   #define DEBUG
-   */
-
-  // ldc = locate data chunk; _sontek_adp = for a SonTek ADV.
+  // ldc = locate data chunk; _sontek_adp = for a SonTek ADP.
   // Arguments:
   //   buf = buffer with data
-  //   Shave_ctd = 1 if have CTD data (must be 0, for this version)
-  //   Shave_gps = 1 if have GPS data (must be 0, for this version)
-  //   Shave_bottom_track = 1 if have bottom-track data (must be 0, for this version)
-  //   Spcadp = 1 if device is a PCADP (which has longer headers)
-  //   Smax = number of profiles to get (set to <0 to get all)
+  //   pcadp = 1 if device is a PCADP (which has longer headers)
+  //   max = number of profiles to get (set to <=0 to get all)
+  // The result is a list holding 'start', the (1-based) indices of the
+  // profiles in buf, and 'layout', a code for the optional blocks in
+  // each, which do_sontek_adp_decode() needs.
   //
-  // Method:
-  //   The code checks for bytes as follows, and does a checksum on
-  //   results.  It has to determine ncell and nbeam first.
-  //     BYTE   Contents
-  //       1    0xA5 (flag 1)
-  //       2    0x10 (flag 2)
-  //       3    0x50 (decimal 80, number of bytes in header)
-  //       4+   See ADPManual_710.pdf, logical page 84 et seq.
-  //
-  // REFERENCES
-  //   1. see ADPManual_710.pdf, logical pages 82-86.
-  //   2. hydratools20apr06/adp2cdf.m line 1360 re PCADP's extra header.
+  // The buffer is scanned once, with the starts held in vectors that
+  // grow as needed.  A profile that passes its checksum is skipped as
+  // a whole, so that its contents are not mistaken for a header.
   unsigned char byte1 = 0xA5;
   unsigned char byte2 = 0x10;
-  unsigned char byte3 = 0x50; /* bytes in header (=80) */
-#ifdef DEBUG
-  Rprintf("have_ctd=%d, have_bottom_track=%d, have_gps=%d, max=%d\n",have_ctd[0],have_bottom_track[0],have_gps[0],max[0]);
-#endif
-  if (have_ctd[0] != 0)
-    ::Rf_error("cannot read SonTek ADP files with CTD data");
-  if (have_bottom_track[0] != 0)
-    ::Rf_error("cannot read SonTek ADP files with bottom-track data");
-  if (have_gps[0] != 0)
-    ::Rf_error("cannot read SonTek ADP files with GPS data");
-  int nbuf = buf.size();
-#ifdef DEBUG
-  Rprintf("nbuf=%d\n", nbuf);
-#endif
-  /* Count matches, so we can allocate the right length */
-  unsigned int matches = 0;
+  unsigned char byte3 = HEADER_LENGTH;
   unsigned short int check_sum_start = ((unsigned short)0xa5<<8)  | ((unsigned short)0x96); /* manual p96 says 0xA596; assume little-endian */
-  if (max[0] < 0)
-    max[0] = 0;
-  /* scan first profile to determine ncell and nbeam */
-  int first_look = 1000;
-  if (first_look > nbuf)
-    ::Rf_error("cannot read Sontek ADP from a buffer with fewer than 1000 bytes");
-  int i;
-  int ncell = -1, nbeam = -1;
-  for (i = 0; i < first_look - 3; i++) { /* note that we don't look to the very end */
-    //Rprintf(" %d: %x %x %x (%x %x %x)\n", i, buf[i], buf[i+1], buf[i+2], byte1, byte2, byte3);
-    if (buf[i] == byte1 && buf[i+1] == byte2 && buf[i+2] == byte3) {
-      nbeam = (int)buf[i + 26];
-      ncell = ((unsigned short)buf[i+30]) | ((unsigned short)buf[i+31] << 8);
-#ifdef DEBUG
-      Rprintf("tentative first-profile at buf[%d], yielding nbeam=%d and ncell=%d\n",
-          i, nbeam, ncell);
-#endif
-      if (nbeam < 2 || nbeam > 3)
-        ::Rf_error("number of beams must be 2 or 3, but it is %d", nbeam);
-      if (ncell < 1)
-        ::Rf_error("number of cells cannot be less than 1, but it is %d", ncell);
+  // Offsets are R_xlen_t values, and are returned as doubles, so that
+  // buffers larger than 2 GiB can be handled.
+  R_xlen_t nbuf = buf.size();
+  const unsigned char *pbuf = &buf[0];
+  int extra = pcadp[0] ? PCADP_EXTRA_LENGTH : 0;
+  int maxProfiles = max[0] > 0 ? max[0] : 0;
+  std::vector<double> start;
+  std::vector<int> layout;
+  int bad = 0, maxbad = 100;
+  int lastLayout = 0;
+  R_xlen_t i = 0;
+  while (i < nbuf - HEADER_LENGTH) {
+    const unsigned char *p = (const unsigned char *)memchr(pbuf + i, byte1, nbuf - HEADER_LENGTH - i);
+    if (!p)
       break;
+    i = p - pbuf;
+    if (pbuf[i+1] != byte2 || pbuf[i+2] != byte3) {
+      i++;
+      continue;
     }
-  }
-  if (nbeam < 0 || ncell < 0)
-    ::Rf_error("cannot determine #beams or #cells, based on first 1000 bytes in buffer");
-  // The next line envisions more data streams, e.g. ctd.
-  int chunk_length = 80 + (have_ctd[0]?16:0) + (have_gps[0]?40:0) + (have_bottom_track[0]?18:0) + 4 * ncell * nbeam;
-  // Next 2 lines acount for extra header in each PCADP profile; see ref 2.
-  int max_beams = 4;
-  int pcadp_extra_header_length = 2*(8+max_beams) + 2*max_beams + max_beams;
-  if (pcadp[0])
-    chunk_length += pcadp_extra_header_length;
-  int bad = 0, maxbad = 100;
-#ifdef DEBUG
-  Rprintf("pcadp=%d pcadp_extra_header_length=%d max_beams=%d\n", pcadp[0], pcadp_extra_header_length, max_beams);
-  Rprintf("bytes: 0x%x 0x%x 0x%x\n", byte1, byte2, byte3);
-  Rprintf("chunk_length: %d\n", chunk_length);
-#endif
-  for (int i = 0; i < nbuf - 3 - chunk_length; i++) { // FIXME is 3 right, or needed?
-    if (buf[i] == byte1 && buf[i+1] == byte2 && buf[i+2] == byte3) {
-      unsigned short int check_sum = check_sum_start; // RHS is fixed
-      unsigned short int desired_check_sum = ((unsigned short)buf[i+chunk_length]) | ((unsigned short)buf[i+chunk_length+1] << 8);
-      for (int c = 0; c < chunk_length; c++)
-        check_sum += (unsigned short int)buf[i + c];
-      if (check_sum == desired_check_sum) {
-        matches++;
-#ifdef DEBUG
-        Rprintf("OK  at buf[%d]: check_sum=%d (should be %d); check_sum_start=%d\n",
-            i, check_sum, desired_check_sum, check_sum_start);
-#endif
-        if (max[0] != 0 && matches >= (unsigned int)max[0])
+    int nbeam = sontek_adp_nbeam(p), ncell = sontek_adp_ncell(p);
+    int found = -1;
+    R_xlen_t chunk_length = 0;
+    if (nbeam >= 1 && nbeam <= MAX_BEAMS && ncell >= 1) {
+      R_xlen_t base = HEADER_LENGTH + extra + 4 * (R_xlen_t)ncell * nbeam;
+      for (int k = 0; k < 8; k++) {
+        // try the previous layout first, since layouts seldom change
+        int try_layout = k == 0 ? lastLayout : (k == lastLayout ? 0 : k);
+        chunk_length = base + sontek_adp_blocks_length(try_layout);
+        if (i + chunk_length + 2 > nbuf)
+          continue;
+        unsigned short int desired_check_sum = ((unsigned short)pbuf[i+chunk_length]) | ((unsigned short)pbuf[i+chunk_length+1] << 8);
+        if (desired_check_sum == oce_checksum_bytes(p, chunk_length, check_sum_start)) {
+          found = try_layout;
           break;
-      } else {
-#ifdef DEBUG
-        Rprintf("BAD at buf[%d]: check_sum=%d (should be %d); check_sum_start=%d\n",
-            i, check_sum, desired_check_sum, check_sum_start);
-#endif
-        if (bad++ > maxbad)
-          ::Rf_error("bad=%d exceeds maxbad=%d\n", bad, maxbad);
+        }
       }
     }
-  }
-  /* allocate space, then run through whole buffer again, noting the matches */
-  unsigned int nres = matches;
-  IntegerVector res(nres>0?nres:1, 1);
-  if (nres > 0) {
+    if (found < 0) {
 #ifdef DEBUG
-    Rprintf("getting space for %d matches\n", nres);
+      Rprintf("BAD at buf[%lld]: nbeam=%d ncell=%d\n", (long long)i, nbeam, ncell);
 #endif
-    unsigned int ires = 0;
-    for (int i=0; i<(nbuf-3-chunk_length); i++) { // FIXME is 3 right, or needed?
-      if (buf[i] == byte1 && buf[i+1] == byte2 && buf[i+2] == byte3) {
-        unsigned short int check_sum = check_sum_start; // RHS is fixed
-        unsigned short int desired_check_sum = ((unsigned short)buf[i+chunk_length]) | ((unsigned short)buf[i+chunk_length+1] << 8);
-        for (int c = 0; c < chunk_length; c++)
-          check_sum += (unsigned short int)buf[i + c];
-        if (check_sum == desired_check_sum)
-          res[ires++] = i + 1; /* the +1 is to get R pointers */
-        if (ires > nres)        /* FIXME: or +1? */
+      // Many failures before any success suggest that pcadp is wrong,
+      // so return no profiles and let the caller try the alternative.
+      if (bad++ > maxbad) {
+        if (start.empty())
           break;
+        ::Rf_error("bad=%d exceeds maxbad=%d\n", bad, maxbad);
+      }
+      i++;
+      continue;
+    }
+    start.push_back((double)(i + 1)); // the +1 is to get R pointers
+    layout.push_back(found);
+    lastLayout = found;
+    if (maxProfiles && (int)start.size() >= maxProfiles)
+      break;
+    i += chunk_length + 2;
+  }
+  return(List::create(Named("start")=NumericVector(start.begin(), start.end()),
+        Named("layout")=IntegerVector(layout.begin(), layout.end())));
+}
+
+// [[Rcpp::export]]
+List do_sontek_adp_decode(RawVector buf, NumericVector start, IntegerVector layout, IntegerVector pcadp)
+{
+  // Decode the profiles of a SonTek ADP file, for read.adp.sontek() and
+  // read.adp.sontek.serial().  Arguments:
+  //   buf = buffer with data
+  //   start = (1-based) indices of the profiles to decode
+  //   layout = codes for the optional blocks of those profiles, from
+  //            do_ldc_sontek_adp()
+  //   pcadp = 1 if device is a PCADP (which has longer headers)
+  // The result holds the time components, heading, pitch, roll,
+  // temperature and pressure from the profile headers, and
+  // velocities (m/s), standard deviations and amplitudes, as arrays
+  // with indices [profile, cell, beam].  These have as many cells and
+  // beams as the largest profile; the extra elements of smaller ones
+  // are NA (velocity) or 0.  The CTD, GPS and bottom-track blocks,
+  // whose contents are not documented in ref 1, are returned as raw
+  // matrices with a row per profile, which is 0 for profiles lacking
+  // the block, and the logical vectors haveCTD, haveGPS and
+  // haveBottomTrack tell which profiles have them.
+  R_xlen_t nbuf = buf.size(), np = start.size();
+  if (layout.size() != np)
+    ::Rf_error("layout has length %lld but start has length %lld", (long long)layout.size(), (long long)np);
+  const unsigned char *pbuf = &buf[0];
+  int extra = pcadp[0] ? PCADP_EXTRA_LENGTH : 0;
+  int ncell = 0, nbeam = 0, anyLayout = 0;
+  for (R_xlen_t i = 0; i < np; i++) {
+    R_xlen_t s = (R_xlen_t)start[i] - 1;
+    if (ISNAN(start[i]) || s < 0 || s + HEADER_LENGTH > nbuf)
+      ::Rf_error("start[%lld]=%.0f is not within the buffer", (long long)i + 1, start[i]);
+    if (layout[i] < 0 || layout[i] > 7)
+      ::Rf_error("layout[%lld]=%d is not a valid code", (long long)i + 1, layout[i]);
+    const unsigned char *p = pbuf + s;
+    if (sontek_adp_nbeam(p) > nbeam)
+      nbeam = sontek_adp_nbeam(p);
+    if (sontek_adp_ncell(p) > ncell)
+      ncell = sontek_adp_ncell(p);
+    anyLayout |= layout[i];
+  }
+  R_xlen_t nv = np * (R_xlen_t)ncell * nbeam;
+  NumericVector v(nv, NA_REAL);
+  RawVector std(nv), amp(nv);
+  NumericVector year(np), month(np), day(np), hour(np), minute(np), second(np);
+  NumericVector heading(np), pitch(np), roll(np), temperature(np), pressure(np);
+  LogicalVector haveCTD(np), haveGPS(np), haveBottomTrack(np);
+  RawMatrix ctd((anyLayout & HAVE_CTD) ? np : 0, CTD_LENGTH);
+  RawMatrix gps((anyLayout & HAVE_GPS) ? np : 0, GPS_LENGTH);
+  RawMatrix bottomTrack((anyLayout & HAVE_BOTTOM_TRACK) ? np : 0, BOTTOM_TRACK_LENGTH);
+  for (R_xlen_t i = 0; i < np; i++) {
+    const unsigned char *p = pbuf + (R_xlen_t)start[i] - 1;
+    int pnbeam = sontek_adp_nbeam(p), pncell = sontek_adp_ncell(p);
+    R_xlen_t n = (R_xlen_t)pncell * pnbeam;
+    R_xlen_t offset = HEADER_LENGTH + extra;
+    if ((R_xlen_t)start[i] - 1 + offset + sontek_adp_blocks_length(layout[i]) + 4 * n > nbuf)
+      ::Rf_error("profile %lld, at start=%.0f, extends past the end of the buffer", (long long)i + 1, start[i]);
+    // header (ref 1 p84)
+    year[i] = ((unsigned short)p[18]) | ((unsigned short)p[19] << 8);
+    day[i] = p[20];
+    month[i] = p[21];
+    minute[i] = p[22];
+    hour[i] = p[23];
+    second[i] = p[25] + p[24] / 100.0; // SIG p82 C code suggests sec100 comes before second.
+    heading[i] = (short)(p[40] | (p[41] << 8)) / 10.0;
+    pitch[i] = (short)(p[42] | (p[43] << 8)) / 10.0;
+    roll[i] = (short)(p[44] | (p[45] << 8)) / 10.0;
+    temperature[i] = (short)(p[46] | (p[47] << 8)) / 100.0;
+    pressure[i] = (unsigned short)(p[48] | (p[49] << 8)) / 100.0;
+    // optional blocks
+    if (layout[i] & HAVE_CTD) {
+      haveCTD[i] = 1;
+      for (int k = 0; k < CTD_LENGTH; k++)
+        ctd(i, k) = p[offset + k];
+      offset += CTD_LENGTH;
+    }
+    if (layout[i] & HAVE_GPS) {
+      haveGPS[i] = 1;
+      for (int k = 0; k < GPS_LENGTH; k++)
+        gps(i, k) = p[offset + k];
+      offset += GPS_LENGTH;
+    }
+    if (layout[i] & HAVE_BOTTOM_TRACK) {
+      haveBottomTrack[i] = 1;
+      for (int k = 0; k < BOTTOM_TRACK_LENGTH; k++)
+        bottomTrack(i, k) = p[offset + k];
+      offset += BOTTOM_TRACK_LENGTH;
+    }
+    // profile data, stored with cell varying fastest
+    const unsigned char *vp = p + offset, *sp = vp + 2 * n, *ap = sp + n;
+    for (int b = 0; b < pnbeam; b++) {
+      for (int c = 0; c < pncell; c++) {
+        R_xlen_t k = c + (R_xlen_t)b * pncell;
+        R_xlen_t o = i + np * (c + (R_xlen_t)ncell * b);
+        v[o] = 1e-3 * (short)(vp[2*k] | (vp[2*k+1] << 8));
+        std[o] = sp[k];
+        amp[o] = ap[k];
       }
     }
-    return(res);
-  } else {
-    res[0] = NA_INTEGER;
   }
+  IntegerVector dim = IntegerVector::create((int)np, ncell, nbeam);
+  v.attr("dim") = dim;
+  std.attr("dim") = dim;
+  amp.attr("dim") = dim;
+  List res = List::create(Named("year")=year, Named("month")=month,
+      Named("day")=day, Named("hour")=hour, Named("minute")=minute,
+      Named("second")=second, Named("heading")=heading,
+      Named("pitch")=pitch, Named("roll")=roll,
+      Named("temperature")=temperature, Named("pressure")=pressure,
+      Named("v")=v, Named("std")=std, Named("amp")=amp,
+      Named("haveCTD")=haveCTD, Named("haveGPS")=haveGPS,
+      Named("haveBottomTrack")=haveBottomTrack);
+  // List::create() takes at most 20 arguments
+  res["ctd"] = ctd;
+  res["gps"] = gps;
+  res["bottomTrack"] = bottomTrack;
   return(res);
 }
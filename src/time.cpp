@@ -1,62 +1,98 @@
 /* vim: set expandtab shiftwidth=2 softtabstop=2 tw=70: */
 
 #include <Rcpp.h>
+#include "civil_time.h"
 using namespace Rcpp;
 
 //#define DEBUG
 
-// Convert Epic time (julian day along with millisecond in that day)
-// into year, month, day, hour, second.
-#define JULGREG   2299161
+// The Julian day of 1970-01-01. An EPIC time is a Julian day, counted
+// from midnight rather than noon, with the milliseconds into that day.
+#define EPIC_JULIAN_DAY_1970 2440588
 
+// Move whole days from the millisecond count into the julian day,
+// leaving the millisecond in [0, 86400000), for counts that are
+// negative as well as ones that exceed a day.
+static void epic_normalise(long long *julianDay, long long *millisecond)
+{
+  long long days = *millisecond / 86400000;
+  if (*millisecond % 86400000 < 0)
+    days--;
+  *julianDay += days;
+  *millisecond -= days * 86400000;
+}
+
+// Convert Epic time (julian day along with millisecond in that day)
+// into seconds since 1970-01-01 UTC. Days before the Gregorian reform
+// are treated as the proleptic Gregorian calendar used by POSIXct.
+//
 // [[Rcpp::export]]
-List do_epic_time_to_ymdhms(IntegerVector julianDay, IntegerVector millisecond)
+NumericVector do_epic_time_to_posixct(IntegerVector julianDay, IntegerVector millisecond)
 {
   int n = julianDay.size(); // The R code ensures length matches that of millisecond
-  IntegerVector year(n), month(n), day(n), hour(n), minute(n);
-  NumericVector second(n);
-
-  long int ja, jalpha, jb, jc, jd, je;
+  NumericVector res(n);
   for (int i = 0; i < n; i++) {
 #ifdef DEBUG
     Rprintf("julianDay[%d]=%d, milliscond[%d]=%d\n", i, julianDay[i], i, millisecond[i]);
 #endif
-    while(millisecond[i] >= 86400000) { /* increament days if ms larger then one day */
-      julianDay[i] = julianDay[i] + 1;
-      millisecond[i] = millisecond[i] - 86400000;
-#ifdef DEBUG
-      Rprintf("Altered to julianDay[i]=%d millisecond[i]=%d\n", julianDay[i], millisecond[i]);
-#endif
+    if (julianDay[i] == NA_INTEGER || millisecond[i] == NA_INTEGER) {
+      res[i] = NA_REAL;
+      continue;
     }
-    if(julianDay[i] >= JULGREG) {
-      jalpha = (long)(((double) (julianDay[i] - 1867216) - 0.25) / 36524.25);
-      ja = julianDay[i] + 1 + jalpha - (long)(0.25*jalpha);
-    } else {
-      ja = julianDay[i];
+    long long jday = julianDay[i], ms = millisecond[i];
+    epic_normalise(&jday, &ms);
+    res[i] = 86400.0 * (jday - EPIC_JULIAN_DAY_1970) + ms / 1000.0;
+  }
+  return(res);
+}
+
+// Convert calendar components to seconds since 1970-01-01 UTC, as
+// ISOdatetime(year, month, day, hour, minute, second, tz="UTC") would,
+// but without formatting and parsing a string for each element.
+// Arguments are recycled to the length of the longest, and invalid
+// times yield NA.
+//
+// [[Rcpp::export]]
+NumericVector do_ymdhms_to_posixct(NumericVector year, NumericVector month, NumericVector day,
+    NumericVector hour, NumericVector minute, NumericVector second)
+{
+  R_xlen_t len[6] = {year.size(), month.size(), day.size(), hour.size(), minute.size(), second.size()};
+  R_xlen_t n = 0;
+  for (int k = 0; k < 6; k++) {
+    if (len[k] == 0)
+      return(NumericVector(0));
+    if (len[k] > n)
+      n = len[k];
+  }
+  NumericVector res(n);
+  for (R_xlen_t i = 0; i < n; i++) {
+    double t = oce_civil_to_seconds(year[i % len[0]], month[i % len[1]], day[i % len[2]],
+        hour[i % len[3]], minute[i % len[4]], second[i % len[5]]);
+    res[i] = ISNAN(t) ? NA_REAL : t;
+  }
+  return(res);
+}
+
+// Decode the 6-byte binary-coded-decimal clocks that Nortek
+// instruments write (minute, second, day, hour, year, month), starting
+// at the 0-based offsets 'clock' within 'buf', and convert them to
+// seconds since 1970-01-01 UTC. Years are taken to be in the 2000s.
+//
+// [[Rcpp::export]]
+NumericVector do_nortek_clock_to_posixct(RawVector buf, NumericVector clock)
+{
+  R_xlen_t n = clock.size(), nbuf = buf.size();
+  NumericVector res(n);
+  const unsigned char *b = &buf[0];
+  for (R_xlen_t i = 0; i < n; i++) {
+    if (ISNAN(clock[i]) || clock[i] < 0 || clock[i] + 6 > nbuf) {
+      res[i] = NA_REAL;
+      continue;
     }
-    jb = ja+1524;
-    jc = (long)(6680.0+((double)(jb-2439870)-122.1)/365.25);
-    jd = (long)(365*jc + (0.25*jc));
-    je = (long)((jb - jd)/30.6001);
-    day[i] = jb - jd - (long int)(30.6001*je);
-    month[i] = je - 1;
-    if(month[i] > 12)
-      month[i] -= 12;
-    year[i] = jc - 4715;
-    if(month[i] > 2)
-      year[i] = year[i] - 1;
-    if(year[i] <= 0)
-      year[i] = year[i] - 1;
-    ja = millisecond[i] / 1000;
-    hour[i] = ja / 3600;
-    minute[i] = (ja - (hour[i]) * 3600) / 60;
-    second[i] = (double)(millisecond[i] - ((hour[i])*3600 + (minute[i])*60)*1000)/1000.0;
+    const unsigned char *c = b + (R_xlen_t)clock[i];
+    double t = oce_civil_to_seconds(2000 + oce_bcd(c[4]), oce_bcd(c[5]), oce_bcd(c[2]),
+        oce_bcd(c[3]), oce_bcd(c[0]), oce_bcd(c[1]));
+    res[i] = ISNAN(t) ? NA_REAL : t;
   }
-  return(List::create(
-    Named("year")=year,
-    Named("month")=month,
-    Named("day")=day,
-    Named("hour")=hour,
-    Named("minute")=minute,
-    Named("second")=second));
+  return(res);
 }